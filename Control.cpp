@@ -0,0 +1,318 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "SoapySDRPlay3.hpp"
+
+/*******************************************************************
+ * Asynchronous control
+ *
+ * With async_control enabled setFrequency() and setGain() return right
+ * away: the value is left in the slot for its kind (a later value
+ * replaces one that has not been applied yet) and the control thread
+ * applies all the pending ones with a single sdrplay_api_Update.
+ ******************************************************************/
+
+// retunes from the hop and sweep engines (engine = true) share the slots
+// but are left out of the ctrl_* counters, which count application requests
+void SoapySDRPlay3::queueControl(ControlKind kind, double value, bool engine)
+{
+    {
+        std::lock_guard<std::mutex> lock(_ctrl_mutex);
+        ControlSlot &slot = ctrlSlots[kind];
+        if (!engine) ctrlRequests++;
+        if (slot.pending && !slot.engine)
+        {
+            // the superseded request counts as completed
+            ctrlSuperseded++;
+            ctrlCompleted++;
+            if (engine) ctrlPending--;
+        }
+        else if (!engine)
+        {
+            ctrlPending++;
+        }
+        slot.pending = true;
+        slot.engine = engine;
+        slot.value = value;
+    }
+    ctrlCond.notify_one();
+}
+
+void SoapySDRPlay3::startControlThread(void)
+{
+    std::lock_guard<std::mutex> lock(_ctrl_mutex);
+    if (ctrlRunning)
+    {
+        return;
+    }
+    ctrlRunning = true;
+    ctrlThread = std::thread(&SoapySDRPlay3::runControl, this);
+}
+
+void SoapySDRPlay3::stopControlThread(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(_ctrl_mutex);
+        if (!ctrlRunning)
+        {
+            return;
+        }
+        // whatever is still pending is applied before the thread exits,
+        // except the timed commands that are not due yet
+        ctrlRunning = false;
+    }
+    ctrlCond.notify_one();
+    ctrlThread.join();
+}
+
+// the control thread serves the asynchronous setters, the timed commands
+// and the hop and sweep engines
+void SoapySDRPlay3::updateControlThread(void)
+{
+    bool timed;
+    {
+        std::lock_guard<std::mutex> lock(_ctrl_mutex);
+        timed = !timedQueue.empty();
+    }
+    if (asyncControl || hopping || sweeping || timed)
+    {
+        startControlThread();
+    }
+    else
+    {
+        stopControlThread();
+    }
+}
+
+void SoapySDRPlay3::runControl(void)
+{
+    std::unique_lock<std::mutex> lock(_ctrl_mutex);
+    while (true)
+    {
+        ControlSlot batch[CONTROL_KINDS];
+        unsigned int numPending = 0;
+        unsigned int numRequests = 0;
+        for (int k = 0; k < CONTROL_KINDS; k++)
+        {
+            batch[k] = ctrlSlots[k];
+            ctrlSlots[k].pending = false;
+            if (batch[k].pending) numPending++;
+            if (batch[k].pending && !batch[k].engine) numRequests++;
+        }
+
+        // timed commands that are due go into the same update; a later
+        // one of the same kind replaces an earlier one
+        long long awaitNs[CONTROL_KINDS] = {0, 0, 0, 0};
+        bool timedWait = false;
+        std::chrono::steady_clock::time_point timedDeadline;
+        long long leadNs = (long long)updateLatency.percentile(0.99);
+        while (!timedQueue.empty())
+        {
+            const TimedControl &command = timedQueue.front();
+            if (!ctrlRunning)
+            {
+                // issued now they would land at an arbitrary time
+                SoapySDR_logf(SOAPY_SDR_WARNING, "timed control: dropping %d command(s) not issued yet", (int)timedQueue.size());
+                ctrlPending -= timedQueue.size();
+                timedQueue.clear();
+                break;
+            }
+            std::chrono::steady_clock::time_point when;
+            if (!timeToSteady(command.timeNs - leadNs, when))
+            {
+                // no time base until the stream runs: hold them and look
+                // again in a while
+                timedWait = true;
+                timedDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+                break;
+            }
+            if (when > std::chrono::steady_clock::now())
+            {
+                timedWait = true;
+                timedDeadline = when;
+                break;
+            }
+            batch[command.kind].pending = true;
+            batch[command.kind].engine = false;
+            batch[command.kind].value = command.value;
+            awaitNs[command.kind] = command.timeNs;
+            timedIssued++;
+            numPending++;
+            numRequests++;
+            timedQueue.pop_front();
+        }
+
+        if (numPending == 0)
+        {
+            if (!ctrlRunning)
+            {
+                break;
+            }
+            if (timedWait)
+            {
+                ctrlCond.wait_until(lock, timedDeadline);
+            }
+            else
+            {
+                ctrlCond.wait(lock);
+            }
+            continue;
+        }
+        lock.unlock();
+
+        {
+            std::lock_guard <std::mutex> stateLock(_general_state_mutex);
+
+            int kindReason[CONTROL_KINDS] = {sdrplay_api_Update_None, sdrplay_api_Update_None, sdrplay_api_Update_None, sdrplay_api_Update_None};
+            if (batch[CONTROL_RF].pending)   kindReason[CONTROL_RF] = applyFrequency("RF", batch[CONTROL_RF].value);
+            if (batch[CONTROL_CORR].pending) kindReason[CONTROL_CORR] = applyFrequency("CORR", batch[CONTROL_CORR].value);
+            if (batch[CONTROL_IFGR].pending) kindReason[CONTROL_IFGR] = applyGain("IFGR", batch[CONTROL_IFGR].value);
+            if (batch[CONTROL_RFGR].pending) kindReason[CONTROL_RFGR] = applyGain("RFGR", batch[CONTROL_RFGR].value);
+            int reason = sdrplay_api_Update_None;
+            for (int k = 0; k < CONTROL_KINDS; k++) reason |= kindReason[k];
+            if ((reason != sdrplay_api_Update_None) && (streamActive))
+            {
+                // timed commands that change something wait for the change
+                // that follows this update to be reported; the API reports
+                // a single gain change for both gain kinds and none for a
+                // correction
+                long long gainNs = 0;
+                if (kindReason[CONTROL_IFGR] != sdrplay_api_Update_None) gainNs = std::max(gainNs, awaitNs[CONTROL_IFGR]);
+                if (kindReason[CONTROL_RFGR] != sdrplay_api_Update_None) gainNs = std::max(gainNs, awaitNs[CONTROL_RFGR]);
+                if ((awaitNs[CONTROL_RF] != 0 && kindReason[CONTROL_RF] != sdrplay_api_Update_None) || gainNs != 0)
+                {
+                    std::lock_guard<std::mutex> awaitLock(_timed_await_mutex);
+                    if (awaitNs[CONTROL_RF] != 0 && kindReason[CONTROL_RF] != sdrplay_api_Update_None)
+                    {
+                        timedAwait.push_back({awaitNs[CONTROL_RF], SOAPY_SDRPLAY_FREQUENCY_CHANGED, rfUpdatesIssued + 1});
+                    }
+                    if (gainNs != 0)
+                    {
+                        timedAwait.push_back({gainNs, SOAPY_SDRPLAY_GAIN_CHANGED, grUpdatesIssued + 1});
+                    }
+                }
+                updateDevice((sdrplay_api_ReasonForUpdateT)reason, sdrplay_api_Update_Ext1_None);
+            }
+            publishSnapshot();
+        }
+
+        ctrlCompleted += numRequests;
+        ctrlPending -= numRequests;
+        lock.lock();
+    }
+}
+
+/*******************************************************************
+ * Frequency hopping
+ *
+ * The rx callback counts the samples of each hop; when the dwell is
+ * over it asks the control thread to retune to the next frequency and
+ * discards the samples until the API flags the frequency change
+ * (rfChanged). Every buffer in the fifo holds samples of one hop and is
+ * tagged with its frequency.
+ ******************************************************************/
+
+void SoapySDRPlay3::setHopList(const std::string &list)
+{
+    std::vector<double> freqs;
+    const char *p = list.c_str();
+    while (*p)
+    {
+        char *end;
+        double f = std::strtod(p, &end);
+        if (end == p)
+        {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "hop_list: invalid frequency list '%s'", list.c_str());
+            return;
+        }
+        freqs.push_back(f);
+        p = end;
+        while (*p == ',' || *p == ' ') p++;
+    }
+
+    double rfHz = readSnapshot().rfHz;
+    {
+        std::lock_guard<std::mutex> lock(_hop_mutex);
+        hopList = freqs;
+        hopIndex = 0;
+        hopDwellCount = 0;
+        hopSettleCount = 0;
+        hopSettling = false;
+        hopFrequency = freqs.empty() ? 0.0 : freqs[0];
+        if (!freqs.empty() && freqs[0] != rfHz)
+        {
+            // the samples are discarded until the first retune lands
+            hopSettling = streamActive;
+            queueControl(CONTROL_RF, freqs[0], true);
+        }
+        hopping = !freqs.empty();
+    }
+}
+
+// returns false if the samples have to be discarded
+bool SoapySDRPlay3::hopCallback(const sdrplay_api_StreamCbParamsT *params, unsigned int numSamples)
+{
+    std::lock_guard<std::mutex> lock(_hop_mutex);
+
+    if (hopList.empty())
+    {
+        return true;
+    }
+
+    if (hopSettling)
+    {
+        hopSettleCount += numSamples;
+        if (!params->rfChanged)
+        {
+            if (hopSettleCount < DEFAULT_HOP_SETTLE_TIMEOUT * reqSampleRate)
+            {
+                hopSamplesDiscarded += numSamples;
+                return false;
+            }
+            hopSettleTimeouts++;
+        }
+        hopSettling = false;
+        hopDwellCount = 0;
+        hopFrequency = hopList[hopIndex];
+    }
+
+    hopDwellCount += numSamples;
+    unsigned long long dwell = hopDwellSamples ? hopDwellSamples : (unsigned long long)(hopDwellSeconds * reqSampleRate);
+    if (dwell > 0 && hopDwellCount >= dwell && hopList.size() > 1)
+    {
+        hopIndex = (hopIndex + 1) % hopList.size();
+        hopDwellCount = 0;
+        if (hopList[hopIndex] != hopFrequency)
+        {
+            hopSettling = true;
+            hopSettleCount = 0;
+            queueControl(CONTROL_RF, hopList[hopIndex], true);
+        }
+        hops++;
+    }
+    return true;
+}
@@ -1,7 +1,31 @@
+# search again whenever SDRPLAY_API_ROOT is changed
+if(NOT "${SDRPLAY_API_ROOT}" STREQUAL "${LIBSDRPLAY_ROOT_USED}")
+  unset(LIBSDRPLAY_FOUND CACHE)
+  unset(LIBSDRPLAY_INCLUDE_DIRS CACHE)
+  unset(LIBSDRPLAY_LIBRARIES CACHE)
+  set(LIBSDRPLAY_ROOT_USED "${SDRPLAY_API_ROOT}" CACHE INTERNAL "SDRPLAY_API_ROOT of the last search")
+endif()
+
 if(NOT LIBSDRPLAY_FOUND)
   # pkg_check_modules (LIBSDRPLAY_PKG libsdrplay)
 
-  IF(WIN32)  
+  IF(SDRPLAY_API_ROOT)
+	  # only look in the given prefix, so that an alternative sdrplay_api
+	  # is never silently replaced by the installed one
+	  find_path(LIBSDRPLAY_INCLUDE_DIRS NAMES sdrplay_api.h
+		PATHS
+		"${SDRPLAY_API_ROOT}/include"
+		"${SDRPLAY_API_ROOT}/inc"
+		NO_DEFAULT_PATH
+	  )
+
+	  find_library(LIBSDRPLAY_LIBRARIES NAMES sdrplay_api
+		PATHS
+		"${SDRPLAY_API_ROOT}/lib"
+		"${SDRPLAY_API_ROOT}"
+		NO_DEFAULT_PATH
+	  )
+  ELSEIF(WIN32)  
 	  GET_FILENAME_COMPONENT(SDRPLAY_API_DIR "[HKEY_LOCAL_MACHINE\\SOFTWARE\\SDRplay\\API;Install_Dir]" ABSOLUTE)
 
      if( CMAKE_SIZEOF_VOID_P EQUAL 8 )
@@ -0,0 +1,338 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "SoapySDRPlay3.hpp"
+
+/*******************************************************************
+ * Device updates
+ ******************************************************************/
+
+sdrplay_api_ErrT SoapySDRPlay3::updateDevice(sdrplay_api_ReasonForUpdateT reasonForUpdate,
+                                             sdrplay_api_ReasonForUpdateExtension1T reasonForUpdateExt1)
+{
+    // inside a transaction just collect the reasons of the thread that
+    // opened it; the updates of the control thread, the hop and sweep
+    // engines and the overload acknowledgements from the event callback
+    // cannot wait for the commit
+    if (txnOpen && txnThread.load() == std::this_thread::get_id() && reasonForUpdate != sdrplay_api_Update_Ctrl_OverloadMsgAck)
+    {
+        txnReason = (sdrplay_api_ReasonForUpdateT)(txnReason | reasonForUpdate);
+        txnReasonExt1 = (sdrplay_api_ReasonForUpdateExtension1T)(txnReasonExt1 | reasonForUpdateExt1);
+        txnStagedUpdates++;
+        return sdrplay_api_Success;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    sdrplay_api_ErrT err = sdrplay_api_Update(device.dev, device.tuner, reasonForUpdate, reasonForUpdateExt1);
+    unsigned long long elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    updateCalls++;
+    if (err == sdrplay_api_Success)
+    {
+        countChangeUpdate(reasonForUpdate);
+    }
+    updateTimeNs += elapsedNs;
+    updateLatency.record(elapsedNs);
+    unsigned long long maxNs = updateMaxNs;
+    while (elapsedNs > maxNs && !updateMaxNs.compare_exchange_weak(maxNs, elapsedNs)) {}
+    if (err != sdrplay_api_Success)
+    {
+        updateErrors++;
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Update Error: %s", sdrplay_api_GetErrorString(err));
+    }
+    return err;
+}
+
+/*******************************************************************
+ * Metrics
+ ******************************************************************/
+
+struct MetricInfo
+{
+    const char *name;
+    const char *labels;
+    const char *jsonKey;
+    const char *type;
+    const char *help;
+};
+
+static const MetricInfo tunerMetrics[] = {
+    { "callbacks_total",        "",                     "callbacks_total",                 "counter", "Stream callbacks received" },
+    { "samples_received_total", "",                     "samples_received_total",          "counter", "Samples received from the API" },
+    { "samples_read_total",     "",                     "samples_read_total",              "counter", "Samples handed out to the reader" },
+    { "samples_dropped_total",  ",reason=\"fifo_full\"", "samples_dropped_fifo_full_total", "counter", "Samples dropped, by reason" },
+    { "samples_dropped_total",  ",reason=\"flush\"",     "samples_dropped_flush_total",     "counter", "Samples dropped, by reason" },
+    { "overflow_events_total",  "",                     "overflow_events_total",           "counter", "Fifo overflow events" },
+    { "reset_events_total",     "",                     "reset_events_total",              "counter", "Fifo reset events" },
+    { "read_timeouts_total",    "",                     "read_timeouts_total",             "counter", "Stream reads that timed out" },
+    { "callback_stalls_total",  "",                     "callback_stalls_total",           "counter", "Stream callbacks arriving far later than expected" },
+};
+
+static const MetricInfo deviceMetrics[] = {
+    { "update_calls_total",     "", "update_calls_total",   "counter", "sdrplay_api_Update calls" },
+    { "update_errors_total",    "", "update_errors_total",  "counter", "sdrplay_api_Update calls that failed" },
+    { "update_seconds_total",   "", "update_seconds_total", "counter", "Time spent in sdrplay_api_Update" },
+    { "update_seconds_max",     "", "update_seconds_max",   "gauge",   "Longest sdrplay_api_Update call" },
+    { "txn_commits_total",      "", "txn_commits_total",    "counter", "Settings transactions committed with a single update" },
+    { "txn_staged_updates_total", "", "txn_staged_updates_total", "counter", "Updates coalesced into transaction commits" },
+    { "ctrl_requests_total",    "", "ctrl_requests_total",  "counter", "Asynchronous control requests" },
+    { "ctrl_superseded_total",  "", "ctrl_superseded_total", "counter", "Asynchronous control requests replaced by a later one" },
+    { "ctrl_completed_total",   "", "ctrl_completed_total", "counter", "Asynchronous control requests completed" },
+};
+
+std::string SoapySDRPlay3::formatMetrics(const std::string &format) const
+{
+    const TunerState *states[] = { &_stateA, &_stateB };
+    const char *tunerNames[] = { "A", "B" };
+    int numTuners = (device.hwVer == SDRPLAY_RSPduo_ID && device.rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner) ? 2 : 1;
+
+    unsigned long long tunerValues[2][sizeof(tunerMetrics) / sizeof(tunerMetrics[0])];
+    for (int t = 0; t < numTuners; t++)
+    {
+        tunerValues[t][0] = states[t]->callbacks;
+        tunerValues[t][1] = states[t]->samplesReceived;
+        tunerValues[t][2] = states[t]->samplesRead;
+        tunerValues[t][3] = states[t]->samplesDroppedFull;
+        tunerValues[t][4] = states[t]->samplesDroppedFlush;
+        tunerValues[t][5] = states[t]->overflows;
+        tunerValues[t][6] = states[t]->resets;
+        tunerValues[t][7] = states[t]->timeouts;
+        tunerValues[t][8] = states[t]->stalls;
+    }
+    double deviceValues[] = {
+        (double)updateCalls,
+        (double)updateErrors,
+        updateTimeNs / 1e9,
+        updateMaxNs / 1e9,
+        (double)txnCommits,
+        (double)txnStagedUpdates,
+        (double)ctrlRequests,
+        (double)ctrlSuperseded,
+        (double)ctrlCompleted
+    };
+
+    std::string out;
+    char line[256];
+    std::string serial = device.SerNo;
+
+    if (format == "json")
+    {
+        out = "{\"serial\":\"" + serial + "\",\"tuners\":{";
+        for (int t = 0; t < numTuners; t++)
+        {
+            snprintf(line, sizeof(line), "%s\"%s\":{", t ? "," : "", tunerNames[t]);
+            out += line;
+            for (size_t m = 0; m < sizeof(tunerMetrics) / sizeof(tunerMetrics[0]); m++)
+            {
+                snprintf(line, sizeof(line), "%s\"%s\":%llu", m ? "," : "", tunerMetrics[m].jsonKey, tunerValues[t][m]);
+                out += line;
+            }
+            out += "}";
+        }
+        out += "}";
+        for (size_t m = 0; m < sizeof(deviceMetrics) / sizeof(deviceMetrics[0]); m++)
+        {
+            snprintf(line, sizeof(line), ",\"%s\":%.9g", deviceMetrics[m].jsonKey, deviceValues[m]);
+            out += line;
+        }
+        out += "}\n";
+        return out;
+    }
+
+    // Prometheus text exposition format
+    for (size_t m = 0; m < sizeof(tunerMetrics) / sizeof(tunerMetrics[0]); m++)
+    {
+        if (m == 0 || std::strcmp(tunerMetrics[m].name, tunerMetrics[m - 1].name) != 0)
+        {
+            snprintf(line, sizeof(line), "# HELP sdrplay3_%s %s\n# TYPE sdrplay3_%s %s\n",
+                     tunerMetrics[m].name, tunerMetrics[m].help, tunerMetrics[m].name, tunerMetrics[m].type);
+            out += line;
+        }
+        for (int t = 0; t < numTuners; t++)
+        {
+            snprintf(line, sizeof(line), "sdrplay3_%s{serial=\"%s\",tuner=\"%s\"%s} %llu\n",
+                     tunerMetrics[m].name, serial.c_str(), tunerNames[t], tunerMetrics[m].labels, tunerValues[t][m]);
+            out += line;
+        }
+    }
+    for (size_t m = 0; m < sizeof(deviceMetrics) / sizeof(deviceMetrics[0]); m++)
+    {
+        snprintf(line, sizeof(line), "# HELP sdrplay3_%s %s\n# TYPE sdrplay3_%s %s\nsdrplay3_%s{serial=\"%s\"} %.9g\n",
+                 deviceMetrics[m].name, deviceMetrics[m].help, deviceMetrics[m].name, deviceMetrics[m].type,
+                 deviceMetrics[m].name, serial.c_str(), deviceValues[m]);
+        out += line;
+    }
+    return out;
+}
+
+void SoapySDRPlay3::startMetricsWriter(void)
+{
+    stopMetricsWriter();
+    if (metricsFile.empty() || metricsInterval <= 0)
+    {
+        return;
+    }
+    metricsRunning = true;
+    metricsThread = std::thread(&SoapySDRPlay3::runMetricsWriter, this, metricsFile, metricsFormat, metricsInterval);
+}
+
+void SoapySDRPlay3::stopMetricsWriter(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        if (!metricsRunning)
+        {
+            return;
+        }
+        metricsRunning = false;
+    }
+    metricsCond.notify_one();
+    metricsThread.join();
+}
+
+void SoapySDRPlay3::runMetricsWriter(const std::string path, const std::string format, const double interval)
+{
+    std::string tmpPath = path + ".tmp";
+    std::unique_lock<std::mutex> lock(metricsMutex);
+    while (metricsRunning)
+    {
+        lock.unlock();
+
+        // write to a temporary file and rename it, so that a scraper
+        // never sees a partial file
+        {
+            std::ofstream out(tmpPath.c_str(), std::ios::trunc);
+            out << formatMetrics(format);
+        }
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "Can't write metrics file '%s'", path.c_str());
+        }
+
+        lock.lock();
+        metricsCond.wait_for(lock, std::chrono::duration<double>(interval), [this] { return !metricsRunning; });
+    }
+}
+
+/*******************************************************************
+ * Histogram
+ ******************************************************************/
+
+static unsigned int histogramBucket(unsigned long long value)
+{
+    if (value < 4)
+    {
+        return (unsigned int)value;
+    }
+    unsigned int msb = 2;
+    while (msb < 63 && (value >> (msb + 1)) != 0) msb++;
+    return 4 * (msb - 1) + (unsigned int)((value >> (msb - 2)) & 3);
+}
+
+static unsigned long long histogramBucketUpper(unsigned int bucket)
+{
+    if (bucket < 4)
+    {
+        return bucket;
+    }
+    unsigned int msb = bucket / 4 + 1;
+    unsigned long long lower = (unsigned long long)(4 + bucket % 4) << (msb - 2);
+    return lower + ((1ULL << (msb - 2)) - 1);
+}
+
+SoapySDRPlay3::Histogram::Histogram(void)
+{
+    reset();
+}
+
+void SoapySDRPlay3::Histogram::record(unsigned long long value)
+{
+    buckets[histogramBucket(value)]++;
+    count++;
+    sum += value;
+    unsigned long long v = min;
+    while (value < v && !min.compare_exchange_weak(v, value)) {}
+    v = max;
+    while (value > v && !max.compare_exchange_weak(v, value)) {}
+}
+
+void SoapySDRPlay3::Histogram::reset(void)
+{
+    for (auto &bucket : buckets) bucket = 0;
+    count = 0;
+    sum = 0;
+    min = ~0ULL;
+    max = 0;
+}
+
+unsigned long long SoapySDRPlay3::Histogram::percentile(double p) const
+{
+    unsigned long long total = count;
+    if (total == 0)
+    {
+        return 0;
+    }
+    // report the upper edge of the bucket, but never more than the max
+    unsigned long long target = (unsigned long long)std::ceil(p * total);
+    unsigned long long seen = 0;
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= target && seen > 0)
+        {
+            return std::min(histogramBucketUpper(i), max.load());
+        }
+    }
+    return max;
+}
+
+std::string SoapySDRPlay3::Histogram::toString(double scale, const char *units) const
+{
+    unsigned long long n = count;
+    char str[256];
+    snprintf(str, sizeof(str), "count=%llu,min_%s=%.3f,mean_%s=%.3f,p50_%s=%.3f,p99_%s=%.3f,p99.9_%s=%.3f,max_%s=%.3f",
+             n,
+             units, n ? min / scale : 0.0,
+             units, n ? (double)sum / n / scale : 0.0,
+             units, percentile(0.5) / scale,
+             units, percentile(0.99) / scale,
+             units, percentile(0.999) / scale,
+             units, max / scale);
+    std::string out = str;
+
+    // non empty buckets as '<upper edge>:<count>'
+    out += ",buckets=";
+    bool first = true;
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        unsigned long long c = buckets[i];
+        if (c == 0) continue;
+        snprintf(str, sizeof(str), "%s%.3f:%llu", first ? "" : " ", histogramBucketUpper(i) / scale, c);
+        out += str;
+        first = false;
+    }
+    return out;
+}
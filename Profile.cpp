@@ -0,0 +1,213 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "SoapySDRPlay3.hpp"
+
+/*******************************************************************
+ * Device profiles
+ *
+ * A profile is a text file with one 'key=value' line per tunable
+ * setting; the keys are the setting keys of the module plus the ones
+ * below for the state behind the SoapySDR API calls. Loading a profile
+ * applies all of it in a single settings transaction, so the device
+ * sees at most one sdrplay_api_Update (none before the stream is
+ * activated: sdrplay_api_Init starts the device with the new state).
+ ******************************************************************/
+
+// device dependent settings saved in a profile; the order is the order
+// in which they are applied. RFGR covers rfgain_sel.
+static const char *profileSettings[] = {
+    "agc_setpoint",
+    "extref_ctrl",
+    "biasT_ctrl",
+    "rfnotch_ctrl",
+    "dabnotch_ctrl",
+};
+
+bool SoapySDRPlay3::saveProfile(const std::string &path)
+{
+    std::vector<std::pair<std::string, std::string> > entries;
+
+    {
+        std::lock_guard <std::mutex> lock(_general_state_mutex);
+
+        if (device.hwVer == SDRPLAY_RSPduo_ID)
+        {
+            entries.push_back(std::make_pair("rspduo_mode", rspDuoModetoString(device.tuner, device.rspDuoMode)));
+        }
+        entries.push_back(std::make_pair("if_mode", IFtoString(chParams->tunerParams.ifType)));
+        entries.push_back(std::make_pair("sample_rate", std::to_string(reqSampleRate)));
+        entries.push_back(std::make_pair("bandwidth", std::to_string(getBwValueFromEnum(chParams->tunerParams.bwType))));
+        entries.push_back(std::make_pair("frequency", std::to_string(chParams->tunerParams.rfFreq.rfHz)));
+        if (deviceParams->devParams)
+        {
+            entries.push_back(std::make_pair("ppm", std::to_string(deviceParams->devParams->ppm)));
+        }
+        // the requested gain reduction; the one reported by getGain() is
+        // the one in use, which the AGC may have changed
+        entries.push_back(std::make_pair("IFGR", std::to_string(chParams->tunerParams.gain.gRdB)));
+        entries.push_back(std::make_pair("RFGR", std::to_string(chParams->tunerParams.gain.LNAstate)));
+        entries.push_back(std::make_pair("gain_mode", chParams->ctrlParams.agc.enable != sdrplay_api_AGC_DISABLE ? "true" : "false"));
+        entries.push_back(std::make_pair("dc_offset_mode", chParams->ctrlParams.dcOffset.DCenable ? "true" : "false"));
+        entries.push_back(std::make_pair("iqcorr_ctrl", chParams->ctrlParams.dcOffset.IQenable ? "true" : "false"));
+    }
+
+    entries.push_back(std::make_pair("antenna", getAntenna(SOAPY_SDR_RX, 0)));
+    SoapySDR::ArgInfoList settings = getSettingInfo();
+    for (const char *key : profileSettings)
+    {
+        for (const auto &arg : settings)
+        {
+            if (arg.key == key)
+            {
+                entries.push_back(std::make_pair(arg.key, readSetting(arg.key)));
+                break;
+            }
+        }
+    }
+
+    std::ofstream out(path.c_str(), std::ios::trunc);
+    if (!out)
+    {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Can't open profile file '%s'", path.c_str());
+        return false;
+    }
+    for (const auto &entry : entries)
+    {
+        out << entry.first << "=" << entry.second << "\n";
+    }
+    out.close();
+    if (!out)
+    {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Can't write profile file '%s'", path.c_str());
+        return false;
+    }
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "profile: saved %zu settings to '%s'", entries.size(), path.c_str());
+    return true;
+}
+
+bool SoapySDRPlay3::loadProfile(const std::string &path)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+    {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Can't open profile file '%s'", path.c_str());
+        return false;
+    }
+    std::map<std::string, std::string> profile;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if (line.empty() || line[0] == '#') continue;
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+        {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "profile: ignoring line '%s'", line.c_str());
+            continue;
+        }
+        profile[line.substr(0, eq)] = line.substr(eq + 1);
+    }
+
+    auto has = [&profile](const char *key) { return profile.count(key) != 0; };
+    auto number = [&profile](const char *key) { return std::strtod(profile[key].c_str(), 0); };
+
+    // a mode change selects the device again, so it can't be part of the
+    // transaction
+    if (device.hwVer == SDRPLAY_RSPduo_ID && has("rspduo_mode") && profile["rspduo_mode"] != readSetting("rspduo_mode"))
+    {
+        writeSetting("rspduo_mode", profile["rspduo_mode"]);
+    }
+
+    // join a transaction opened by the application, if any; one opened
+    // here is also committed if a setter throws, so that the part of the
+    // profile applied so far reaches the device and the getters match it
+    struct TxnGuard
+    {
+        SoapySDRPlay3 *dev;
+        bool open;
+        ~TxnGuard(void)
+        {
+            if (open) dev->writeSetting("txn", "commit");
+        }
+    } txnGuard = { this, !txnOpen };
+    if (txnGuard.open)
+    {
+        writeSetting("txn", "begin");
+    }
+
+    // the IF mode first, since the sample rate and bandwidth depend on it
+    if (has("if_mode")) writeSetting("if_mode", profile["if_mode"]);
+    if (has("sample_rate")) setSampleRate(SOAPY_SDR_RX, 0, number("sample_rate"));
+    if (has("bandwidth")) setBandwidth(SOAPY_SDR_RX, 0, number("bandwidth"));
+    if (has("antenna")) setAntenna(SOAPY_SDR_RX, 0, profile["antenna"]);
+
+    // the tuning is applied here rather than through setFrequency() and
+    // setGain(), which may hand it over to the control thread
+    {
+        std::lock_guard <std::mutex> lock(_general_state_mutex);
+        int reason = sdrplay_api_Update_None;
+        if (has("frequency")) reason |= applyFrequency("RF", number("frequency"));
+        if (has("ppm") && deviceParams->devParams) reason |= applyFrequency("CORR", number("ppm"));
+        if (has("IFGR")) reason |= applyGain("IFGR", number("IFGR"));
+        if (has("RFGR")) reason |= applyGain("RFGR", number("RFGR"));
+        if ((reason != sdrplay_api_Update_None) && (streamActive))
+        {
+            updateDevice((sdrplay_api_ReasonForUpdateT)reason, sdrplay_api_Update_Ext1_None);
+        }
+        publishSnapshot();
+    }
+    if (has("gain_mode")) setGainMode(SOAPY_SDR_RX, 0, profile["gain_mode"] == "true");
+
+    // dc_offset_mode sets both the DC and IQ corrections, iqcorr_ctrl
+    // sets the IQ one and enables the DC one: apply them in the order
+    // that gives back the saved pair
+    bool dcOffset = !has("dc_offset_mode") || profile["dc_offset_mode"] == "true";
+    if (dcOffset && has("dc_offset_mode")) setDCOffsetMode(SOAPY_SDR_RX, 0, true);
+    if (has("iqcorr_ctrl")) writeSetting("iqcorr_ctrl", profile["iqcorr_ctrl"]);
+    if (!dcOffset) setDCOffsetMode(SOAPY_SDR_RX, 0, false);
+
+    for (const char *key : profileSettings)
+    {
+        if (has(key)) writeSetting(key, profile[key]);
+    }
+
+    if (txnGuard.open)
+    {
+        txnGuard.open = false;
+        writeSetting("txn", "commit");
+    }
+
+    {
+        std::lock_guard <std::mutex> lock(_general_state_mutex);
+        std::lock_guard <std::mutex> stringsLock(_strings_mutex);
+        profileFile = path;
+    }
+    SoapySDR_logf(SOAPY_SDR_INFO, "profile: loaded %zu settings from '%s'", profile.size(), path.c_str());
+    return true;
+}
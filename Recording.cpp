@@ -0,0 +1,514 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "SoapySDRPlay3.hpp"
+
+/*******************************************************************
+ * Compressed I/Q file format
+ *
+ * All fields are in host byte order.
+ *
+ * file header:  "SDRPIQZ1", uint32 samples per block, uint32 reserved
+ * block:        uint32 numSamples, uint32 payload bytes,
+ *               uint64 first hardware sample number, payload
+ * payload:      I samples then Q samples, each coded in groups of 32
+ *               values: one byte (bits 0-4 width, bit 7 delta coded)
+ *               followed by 32 zigzag values packed in 'width' bits
+ * index:        per block uint64 offset, uint64 first sample number,
+ *               uint32 numSamples, uint32 reserved
+ * footer:       uint64 index offset, uint32 number of blocks, "IDX1"
+ *
+ * A file without a footer (recorder killed) can still be read: the
+ * index is rebuilt by walking the block headers.
+ ******************************************************************/
+
+static const char recordingMagic[8] = { 'S', 'D', 'R', 'P', 'I', 'Q', 'Z', '1' };
+static const char recordingIndexMagic[4] = { 'I', 'D', 'X', '1' };
+
+#define RECORDING_BLOCK_SAMPLES   (16384)
+#define RECORDING_MAX_QUEUED      (64)
+#define RECORDING_GROUP           (32)
+#define RECORDING_HEADER_SIZE     (16)
+#define RECORDING_BLOCK_HDR_SIZE  (16)
+#define RECORDING_INDEX_SIZE      (24)
+#define RECORDING_FOOTER_SIZE     (16)
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline unsigned int bitWidth(uint32_t v)
+{
+    unsigned int w = 0;
+    while (v) { w++; v >>= 1; }
+    return w;
+}
+
+static void encodeSamples(const short *x, size_t n, std::vector<unsigned char> &out)
+{
+    int32_t prev = 0;
+    uint32_t raw[RECORDING_GROUP];
+    uint32_t delta[RECORDING_GROUP];
+
+    for (size_t g = 0; g < n; g += RECORDING_GROUP)
+    {
+        size_t len = std::min((size_t)RECORDING_GROUP, n - g);
+
+        // fixed size groups keep these loops branch free, so the
+        // compiler can vectorize them
+        uint32_t rawOr = 0;
+        uint32_t deltaOr = 0;
+        for (size_t i = 0; i < RECORDING_GROUP; i++)
+        {
+            int32_t v = i < len ? x[g + i] : prev;
+            raw[i] = zigzag(v);
+            delta[i] = zigzag(v - prev);
+            rawOr |= raw[i];
+            deltaOr |= delta[i];
+            prev = v;
+        }
+
+        // noisy signals often pack better without the delta step
+        unsigned int rawWidth = bitWidth(rawOr);
+        unsigned int deltaWidth = bitWidth(deltaOr);
+        bool useDelta = deltaWidth < rawWidth;
+        unsigned int width = useDelta ? deltaWidth : rawWidth;
+        const uint32_t *z = useDelta ? delta : raw;
+        out.push_back((unsigned char)(width | (useDelta ? 0x80 : 0)));
+
+        uint64_t acc = 0;
+        unsigned int nbits = 0;
+        for (size_t i = 0; i < RECORDING_GROUP; i++)
+        {
+            acc |= (uint64_t)z[i] << nbits;
+            nbits += width;
+            while (nbits >= 8)
+            {
+                out.push_back((unsigned char)acc);
+                acc >>= 8;
+                nbits -= 8;
+            }
+        }
+    }
+}
+
+static bool decodeSamples(const unsigned char *&in, const unsigned char *inEnd, short *x, size_t n)
+{
+    int32_t prev = 0;
+
+    for (size_t g = 0; g < n; g += RECORDING_GROUP)
+    {
+        if (in >= inEnd)
+        {
+            return false;
+        }
+        unsigned int width = *in & 0x1f;
+        bool useDelta = (*in & 0x80) != 0;
+        in++;
+        if (width > 17 || (size_t)(inEnd - in) < width * RECORDING_GROUP / 8)
+        {
+            return false;
+        }
+
+        size_t len = std::min((size_t)RECORDING_GROUP, n - g);
+        uint64_t acc = 0;
+        unsigned int nbits = 0;
+        uint32_t mask = (width == 0) ? 0 : (0xffffffffU >> (32 - width));
+        for (size_t i = 0; i < RECORDING_GROUP; i++)
+        {
+            while (nbits < width)
+            {
+                acc |= (uint64_t)(*in++) << nbits;
+                nbits += 8;
+            }
+            int32_t v = unzigzag((uint32_t)acc & mask);
+            acc >>= width;
+            nbits -= width;
+            if (useDelta)
+            {
+                v += prev;
+            }
+            prev = v;
+            if (i < len)
+            {
+                x[g + i] = (short)v;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename T>
+static void putValue(std::vector<unsigned char> &out, T value)
+{
+    const unsigned char *p = (const unsigned char *)&value;
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+static T getValue(const unsigned char *p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+/*******************************************************************
+ * Recorder
+ ******************************************************************/
+
+SoapySDRPlay3::Recorder::Recorder(void)
+{
+    running = false;
+    fileOffset = 0;
+    pendingFirstSampleNum = 0;
+    rawBytes = 0;
+    encodedBytes = 0;
+    droppedBlocks = 0;
+}
+
+SoapySDRPlay3::Recorder::~Recorder()
+{
+    stop();
+}
+
+bool SoapySDRPlay3::Recorder::start(const std::string &path)
+{
+    stop();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    file.open(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> header(recordingMagic, recordingMagic + sizeof(recordingMagic));
+    putValue<uint32_t>(header, RECORDING_BLOCK_SAMPLES);
+    putValue<uint32_t>(header, 0);
+    file.write((const char *)header.data(), header.size());
+    fileOffset = header.size();
+
+    index.clear();
+    pending.clear();
+    pending.reserve(RECORDING_BLOCK_SAMPLES * DEFAULT_ELEMS_PER_SAMPLE);
+    queue.clear();
+    rawBytes = 0;
+    encodedBytes = 0;
+    droppedBlocks = 0;
+
+    running = true;
+    thread = std::thread(&SoapySDRPlay3::Recorder::run, this);
+    return true;
+}
+
+void SoapySDRPlay3::Recorder::stop(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+        {
+            return;
+        }
+        queuePending();
+        running = false;
+    }
+    cond.notify_one();
+    thread.join();
+}
+
+void SoapySDRPlay3::Recorder::queuePending(void)
+{
+    if (pending.empty())
+    {
+        return;
+    }
+    if (queue.size() >= RECORDING_MAX_QUEUED)
+    {
+        // the disk can't keep up; never block the rx callback
+        droppedBlocks++;
+        pending.clear();
+        return;
+    }
+    queue.push_back(std::make_pair(pendingFirstSampleNum, std::vector<short>()));
+    queue.back().second.swap(pending);
+    pending.reserve(RECORDING_BLOCK_SAMPLES * DEFAULT_ELEMS_PER_SAMPLE);
+    cond.notify_one();
+}
+
+void SoapySDRPlay3::Recorder::write(const short *xi, const short *xq, unsigned int numSamples, unsigned long long firstSampleNum)
+{
+    // called for every block: don't take the lock unless recording
+    if (!running)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!running)
+    {
+        return;
+    }
+
+    for (unsigned int i = 0; i < numSamples; i++)
+    {
+        // blocks always hold consecutive sample numbers
+        size_t n = pending.size() / DEFAULT_ELEMS_PER_SAMPLE;
+        if (n > 0 && (n == RECORDING_BLOCK_SAMPLES || pendingFirstSampleNum + n != firstSampleNum + i))
+        {
+            queuePending();
+            n = 0;
+        }
+        if (n == 0)
+        {
+            pendingFirstSampleNum = firstSampleNum + i;
+        }
+        pending.push_back(xi[i]);
+        pending.push_back(xq[i]);
+    }
+}
+
+void SoapySDRPlay3::Recorder::run(void)
+{
+    std::vector<short> channel(RECORDING_BLOCK_SAMPLES);
+    std::vector<unsigned char> out;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running || !queue.empty())
+    {
+        if (queue.empty())
+        {
+            cond.wait(lock);
+            continue;
+        }
+        std::pair<unsigned long long, std::vector<short> > block;
+        block.swap(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        size_t n = block.second.size() / DEFAULT_ELEMS_PER_SAMPLE;
+        out.clear();
+        putValue<uint32_t>(out, (uint32_t)n);
+        putValue<uint32_t>(out, 0);
+        putValue<uint64_t>(out, block.first);
+
+        // code I and Q as two separate streams
+        for (size_t c = 0; c < DEFAULT_ELEMS_PER_SAMPLE; c++)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                channel[i] = block.second[i * DEFAULT_ELEMS_PER_SAMPLE + c];
+            }
+            encodeSamples(channel.data(), n, out);
+        }
+        uint32_t payloadBytes = (uint32_t)(out.size() - RECORDING_BLOCK_HDR_SIZE);
+        std::memcpy(&out[sizeof(uint32_t)], &payloadBytes, sizeof(payloadBytes));
+
+        file.write((const char *)out.data(), out.size());
+
+        RecordingBlock entry;
+        entry.offset = fileOffset;
+        entry.firstSampleNum = block.first;
+        entry.numSamples = (unsigned int)n;
+        fileOffset += out.size();
+        rawBytes += block.second.size() * sizeof(short);
+        encodedBytes += out.size();
+
+        lock.lock();
+        index.push_back(entry);
+    }
+
+    // append the block index and footer for random access
+    out.clear();
+    for (auto &entry : index)
+    {
+        putValue<uint64_t>(out, entry.offset);
+        putValue<uint64_t>(out, entry.firstSampleNum);
+        putValue<uint32_t>(out, entry.numSamples);
+        putValue<uint32_t>(out, 0);
+    }
+    putValue<uint64_t>(out, fileOffset);
+    putValue<uint32_t>(out, (uint32_t)index.size());
+    out.insert(out.end(), recordingIndexMagic, recordingIndexMagic + sizeof(recordingIndexMagic));
+    file.write((const char *)out.data(), out.size());
+    file.close();
+}
+
+/*******************************************************************
+ * Recording API
+ ******************************************************************/
+
+void SoapySDRPlay3::startRecording(const std::string &path)
+{
+    _recA.stop();
+    _recB.stop();
+    {
+        std::lock_guard <std::mutex> lock(_strings_mutex);
+        recordFile = path;
+    }
+    if (path.empty())
+    {
+        return;
+    }
+
+    if (!_recA.start(path))
+    {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Can't open record file '%s'", path.c_str());
+        std::lock_guard <std::mutex> lock(_strings_mutex);
+        recordFile.clear();
+        return;
+    }
+    if (device.hwVer == SDRPLAY_RSPduo_ID && device.rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner)
+    {
+        if (!_recB.start(path + ".B"))
+        {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "Can't open record file '%s.B'", path.c_str());
+        }
+    }
+}
+
+bool SoapySDRPlay3::readRecordingIndex(const std::string &path, std::vector<RecordingBlock> &index)
+{
+    index.clear();
+
+    std::ifstream in(path.c_str(), std::ios::binary);
+    unsigned char header[RECORDING_HEADER_SIZE];
+    if (!in.read((char *)header, sizeof(header)) || std::memcmp(header, recordingMagic, sizeof(recordingMagic)) != 0)
+    {
+        return false;
+    }
+
+    in.seekg(0, std::ios::end);
+    unsigned long long fileSize = (unsigned long long)in.tellg();
+
+    // use the index written on close if there is one
+    unsigned char footer[RECORDING_FOOTER_SIZE];
+    if (fileSize >= RECORDING_HEADER_SIZE + RECORDING_FOOTER_SIZE)
+    {
+        in.seekg(fileSize - RECORDING_FOOTER_SIZE);
+        if (in.read((char *)footer, sizeof(footer)) &&
+            std::memcmp(footer + 12, recordingIndexMagic, sizeof(recordingIndexMagic)) == 0)
+        {
+            unsigned long long indexOffset = getValue<uint64_t>(footer);
+            uint32_t numBlocks = getValue<uint32_t>(footer + 8);
+            if (indexOffset + (unsigned long long)numBlocks * RECORDING_INDEX_SIZE + RECORDING_FOOTER_SIZE == fileSize)
+            {
+                std::vector<unsigned char> entries((size_t)numBlocks * RECORDING_INDEX_SIZE);
+                in.seekg(indexOffset);
+                if (entries.empty() || in.read((char *)entries.data(), entries.size()))
+                {
+                    for (uint32_t i = 0; i < numBlocks; i++)
+                    {
+                        const unsigned char *p = &entries[i * RECORDING_INDEX_SIZE];
+                        RecordingBlock entry;
+                        entry.offset = getValue<uint64_t>(p);
+                        entry.firstSampleNum = getValue<uint64_t>(p + 8);
+                        entry.numSamples = getValue<uint32_t>(p + 16);
+                        index.push_back(entry);
+                    }
+                    return true;
+                }
+            }
+        }
+    }
+
+    // no usable footer: walk the block headers
+    in.clear();
+    unsigned long long offset = RECORDING_HEADER_SIZE;
+    unsigned char blockHeader[RECORDING_BLOCK_HDR_SIZE];
+    while (offset + RECORDING_BLOCK_HDR_SIZE <= fileSize)
+    {
+        in.seekg(offset);
+        if (!in.read((char *)blockHeader, sizeof(blockHeader)))
+        {
+            break;
+        }
+        RecordingBlock entry;
+        entry.offset = offset;
+        entry.numSamples = getValue<uint32_t>(blockHeader);
+        entry.firstSampleNum = getValue<uint64_t>(blockHeader + 8);
+        uint32_t payloadBytes = getValue<uint32_t>(blockHeader + 4);
+        unsigned long long next = offset + RECORDING_BLOCK_HDR_SIZE + payloadBytes;
+        // every group of 32 values takes at least its width byte
+        uint32_t numGroups = (entry.numSamples + RECORDING_GROUP - 1) / RECORDING_GROUP;
+        if (entry.numSamples == 0 || entry.numSamples > RECORDING_BLOCK_SAMPLES ||
+            payloadBytes < numGroups * DEFAULT_ELEMS_PER_SAMPLE || next > fileSize)
+        {
+            break;
+        }
+        index.push_back(entry);
+        offset = next;
+    }
+    return true;
+}
+
+bool SoapySDRPlay3::readRecordingBlock(const std::string &path, const RecordingBlock &block, std::vector<short> &samples)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    unsigned char blockHeader[RECORDING_BLOCK_HDR_SIZE];
+    in.seekg(block.offset);
+    if (!in.read((char *)blockHeader, sizeof(blockHeader)))
+    {
+        return false;
+    }
+    uint32_t numSamples = getValue<uint32_t>(blockHeader);
+    uint32_t payloadBytes = getValue<uint32_t>(blockHeader + 4);
+    if (numSamples != block.numSamples || numSamples > RECORDING_BLOCK_SAMPLES)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> payload(payloadBytes);
+    if (!in.read((char *)payload.data(), payload.size()))
+    {
+        return false;
+    }
+
+    std::vector<short> channel(numSamples);
+    samples.resize(numSamples * DEFAULT_ELEMS_PER_SAMPLE);
+    const unsigned char *p = payload.data();
+    const unsigned char *pEnd = p + payload.size();
+    for (size_t c = 0; c < DEFAULT_ELEMS_PER_SAMPLE; c++)
+    {
+        if (!decodeSamples(p, pEnd, channel.data(), numSamples))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < numSamples; i++)
+        {
+            samples[i * DEFAULT_ELEMS_PER_SAMPLE + c] = channel[i];
+        }
+    }
+    return true;
+}
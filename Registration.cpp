@@ -31,117 +31,236 @@
 #define sprintf_s(buffer, buffer_size, stringbuffer, ...) (sprintf(buffer, stringbuffer, __VA_ARGS__))
 #endif
 
+// sdrplay_api session shared by find and all the device instances: the
+// API is opened by the first user and closed when the last one is done
+// with it; the selected devices are tracked so that they can be released
+// at exit
+static std::mutex sessionMutex;
 static bool isAtExitRegistered = false;
-static sdrplay_api_DeviceT rspDevs[SDRPLAY_MAX_DEVICES];
-bool isSdrplayApiOpen = false;
-sdrplay_api_DeviceT *deviceSelected = nullptr;
+static unsigned int sessionUsers = 0;
+static std::set<sdrplay_api_DeviceT *> sessionDevices;
 
 static void close_sdrplay_api(void)
 {
-   if (deviceSelected)
+   std::lock_guard<std::mutex> lock(sessionMutex);
+   for (sdrplay_api_DeviceT *dev : sessionDevices)
    {
-      sdrplay_api_ReleaseDevice(deviceSelected);
-      deviceSelected = nullptr;
+      sdrplay_api_ReleaseDevice(dev);
    }
-   if (isSdrplayApiOpen == true)
+   sessionDevices.clear();
+   if (sessionUsers > 0)
    {
       sdrplay_api_Close();
-      isSdrplayApiOpen = false;
+      sessionUsers = 0;
    }
 }
 
-static std::vector<SoapySDR::Kwargs> findSDRPlay3(const SoapySDR::Kwargs &args)
+bool openSdrplayApi(void)
 {
-   std::vector<SoapySDR::Kwargs> results;
-   std::string labelHint;
-   if (args.count("label") != 0) labelHint = args.at("label");
-   unsigned int nDevs = 0;
-   char lblstr[128];
-
+   std::lock_guard<std::mutex> lock(sessionMutex);
    if (isAtExitRegistered == false)
    {
-       atexit(close_sdrplay_api);
-       isAtExitRegistered = true;
+      atexit(close_sdrplay_api);
+      isAtExitRegistered = true;
    }
-
-   if (isSdrplayApiOpen == false)
+   if (sessionUsers == 0)
    {
-      sdrplay_api_ErrT err;
-      if ((err = sdrplay_api_Open()) != sdrplay_api_Success)
+      sdrplay_api_ErrT err = sdrplay_api_Open();
+      if (err != sdrplay_api_Success)
       {
-          return results;
+         SoapySDR_logf(SOAPY_SDR_ERROR, "Open Error: %s", sdrplay_api_GetErrorString(err));
+         return false;
       }
-      isSdrplayApiOpen = true;
    }
+   sessionUsers++;
+   return true;
+}
+
+void closeSdrplayApi(void)
+{
+   std::lock_guard<std::mutex> lock(sessionMutex);
+   if (sessionUsers == 0)
+   {
+      return;
+   }
+   // close the API when nobody uses it, in case some other driver needs it
+   if (--sessionUsers == 0)
+   {
+      sdrplay_api_Close();
+   }
+}
+
+void addSelectedDevice(sdrplay_api_DeviceT *dev)
+{
+   std::lock_guard<std::mutex> lock(sessionMutex);
+   sessionDevices.insert(dev);
+}
+
+void removeSelectedDevice(sdrplay_api_DeviceT *dev)
+{
+   std::lock_guard<std::mutex> lock(sessionMutex);
+   sessionDevices.erase(dev);
+}
+
+// device enumeration cache, shared with the constructor; each listing
+// through the service costs an Open/GetDevices/Close round trip unless a
+// device instance keeps the session open
+static std::mutex enumCacheMutex;
+static std::vector<sdrplay_api_DeviceT> enumCacheDevs;
+static std::map<std::string, unsigned int> enumCacheSerials;
+static std::chrono::steady_clock::time_point enumCacheTime;
+static bool enumCacheValid = false;
+
+// returns false if the cache is empty or older than ttl seconds
+bool getCachedDevices(std::vector<sdrplay_api_DeviceT> &devs, double ttl)
+{
+   std::lock_guard<std::mutex> lock(enumCacheMutex);
+   if (!enumCacheValid || ttl <= 0.0 ||
+       std::chrono::steady_clock::now() - enumCacheTime > std::chrono::duration<double>(ttl))
+   {
+      return false;
+   }
+   devs = enumCacheDevs;
+   return true;
+}
+
+void storeCachedDevices(const sdrplay_api_DeviceT *devs, unsigned int nDevs)
+{
+   std::lock_guard<std::mutex> lock(enumCacheMutex);
+   enumCacheDevs.assign(devs, devs + nDevs);
+   enumCacheSerials.clear();
+   for (unsigned int i = 0; i < nDevs; i++)
+   {
+      enumCacheSerials[devs[i].SerNo] = i;
+   }
+   enumCacheTime = std::chrono::steady_clock::now();
+   enumCacheValid = true;
+}
+
+void invalidateCachedDevices(void)
+{
+   std::lock_guard<std::mutex> lock(enumCacheMutex);
+   enumCacheValid = false;
+}
+
+// index of the device with the given serial number in the last device
+// list, -1 if there is none
+int getCachedDeviceIndex(const std::string &serial)
+{
+   std::lock_guard<std::mutex> lock(enumCacheMutex);
+   auto it = enumCacheSerials.find(serial);
+   return it == enumCacheSerials.end() ? -1 : (int)it->second;
+}
+
+// parses the device index following 'SDRplay3 Dev' in a label; -1 if
+// there is none
+int parseDeviceIndex(const std::string &str)
+{
+   char *end;
+   unsigned long idx = std::strtoul(str.c_str(), &end, 10);
+   if (end == str.c_str() || idx >= SDRPLAY_MAX_DEVICES)
+   {
+      return -1;
+   }
+   return (int)idx;
+}
 
-   if (deviceSelected)
+double getCacheTtl(const SoapySDR::Kwargs &args)
+{
+   if (args.count("cache_ttl") != 0)
    {
-      sdrplay_api_ReleaseDevice(deviceSelected);
-      deviceSelected = nullptr;
+      return std::strtod(args.at("cache_ttl").c_str(), 0);
    }
+   return DEFAULT_ENUM_CACHE_TTL;
+}
+
+static SoapySDR::Kwargs deviceToKwargs(unsigned int devIdx, const sdrplay_api_DeviceT &rspDev)
+{
+   char lblstr[128];
+   SoapySDR::Kwargs dev;
+   dev["driver"] = "sdrplay3";
+   if (rspDev.hwVer == SDRPLAY_RSP1A_ID)
+   {
+      sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSP1A %s", devIdx, rspDev.SerNo);
+   }
+   else if (rspDev.hwVer == SDRPLAY_RSPduo_ID)
+   {
+      sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSPduo %s", devIdx, rspDev.SerNo);
+   }
+   else
+   {
+      sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSP%d %s", devIdx, rspDev.hwVer, rspDev.SerNo);
+   }
+   dev["label"] = lblstr;
+   dev["serial"] = rspDev.SerNo;
+   return dev;
+}
+
+static std::vector<SoapySDR::Kwargs> findSDRPlay3(const SoapySDR::Kwargs &args)
+{
+   std::vector<SoapySDR::Kwargs> results;
+   std::string labelHint;
+   if (args.count("label") != 0) labelHint = args.at("label");
+   std::string serialHint;
+   if (args.count("serial") != 0) serialHint = args.at("serial");
+   sdrplay_api_DeviceT rspDevs[SDRPLAY_MAX_DEVICES];
+   unsigned int nDevs = 0;
+   auto startTime = std::chrono::steady_clock::now();
 
    std::string baseLabel = "SDRplay3 Dev";
 
-   // list devices by API
-   sdrplay_api_LockDeviceApi();
-   sdrplay_api_GetDevices(&rspDevs[0], &nDevs, SDRPLAY_MAX_DEVICES);
+   std::vector<sdrplay_api_DeviceT> cachedDevs;
+   bool cached = getCachedDevices(cachedDevs, getCacheTtl(args));
+   if (cached)
+   {
+      nDevs = (unsigned int)cachedDevs.size();
+      std::copy(cachedDevs.begin(), cachedDevs.end(), rspDevs);
+   }
+   else
+   {
+      if (!openSdrplayApi())
+      {
+         return results;
+      }
+
+      // list devices by API
+      sdrplay_api_LockDeviceApi();
+      sdrplay_api_GetDevices(&rspDevs[0], &nDevs, SDRPLAY_MAX_DEVICES);
+      storeCachedDevices(rspDevs, nDevs);
+
+      sdrplay_api_UnlockDeviceApi();
+      closeSdrplayApi();
+   }
 
    size_t posidx = labelHint.find(baseLabel);
 
-   if (posidx != std::string::npos)
+   if (!serialHint.empty())
    {
-      unsigned int devIdx = labelHint.at(posidx + baseLabel.length()) - 0x30;
-
-      if (devIdx < nDevs)
+      // the serial number selects the device directly
+      int devIdx = getCachedDeviceIndex(serialHint);
+      if (devIdx >= 0 && (unsigned int)devIdx < nDevs)
+      {
+         results.push_back(deviceToKwargs(devIdx, rspDevs[devIdx]));
+      }
+   }
+   else if (posidx != std::string::npos)
+   {
+      int devIdx = parseDeviceIndex(labelHint.substr(posidx + baseLabel.length()));
+      if (devIdx >= 0 && (unsigned int)devIdx < nDevs)
       {
-         SoapySDR::Kwargs dev;
-         dev["driver"] = "sdrplay3";
-         if (rspDevs[devIdx].hwVer == SDRPLAY_RSP1A_ID)
-         {
-             sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSP1A %s", devIdx, rspDevs[devIdx].SerNo);
-         }
-         else if (rspDevs[devIdx].hwVer == SDRPLAY_RSPduo_ID)
-         {
-             sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSPduo %s", devIdx, rspDevs[devIdx].SerNo);
-         }
-         else
-         {
-             sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSP%d %s", devIdx, rspDevs[devIdx].hwVer, rspDevs[devIdx].SerNo);
-         }
-         dev["label"] = lblstr;
-         results.push_back(dev);
+         results.push_back(deviceToKwargs(devIdx, rspDevs[devIdx]));
       }
    }
    else
    {
       for (unsigned int i = 0; i < nDevs; i++)
       {
-         SoapySDR::Kwargs dev;
-         dev["driver"] = "sdrplay3";
-         if (rspDevs[i].hwVer == SDRPLAY_RSP1A_ID)
-         {
-            sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSP1A %s", i, rspDevs[i].SerNo);
-         }
-         else if (rspDevs[i].hwVer == SDRPLAY_RSPduo_ID)
-         {
-            sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSPduo %s", i, rspDevs[i].SerNo);
-         }
-         else
-         {
-            sprintf_s(lblstr, 128, "SDRplay3 Dev%d RSP%d %s", i, rspDevs[i].hwVer, rspDevs[i].SerNo);
-         }
-         dev["label"] = lblstr;
-         results.push_back(dev);
+         results.push_back(deviceToKwargs(i, rspDevs[i]));
       }
    }
 
-   // unlock sdrplay API and close it in case some other driver needs it
-   sdrplay_api_UnlockDeviceApi();
-   if (isSdrplayApiOpen == true)
-   {
-      sdrplay_api_Close();
-      isSdrplayApiOpen = false;
-   }
+   SoapySDR_logf(SOAPY_SDR_DEBUG, "findSDRPlay3: %u device(s) %s in %.3f ms", nDevs, cached ? "from the cache" : "listed",
+                 std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
    return results;
 }
 
@@ -27,44 +27,98 @@
 
 #include "SoapySDRPlay3.hpp"
 
-// globals declared in Registration.cpp
-extern bool isSdrplayApiOpen;
-extern sdrplay_api_DeviceT *deviceSelected;
-
-static sdrplay_api_DeviceT rspDevs[SDRPLAY_MAX_DEVICES];
+// session and device list functions in Registration.cpp
+extern bool openSdrplayApi(void);
+extern void closeSdrplayApi(void);
+extern void addSelectedDevice(sdrplay_api_DeviceT *dev);
+extern void removeSelectedDevice(sdrplay_api_DeviceT *dev);
+extern bool getCachedDevices(std::vector<sdrplay_api_DeviceT> &devs, double ttl);
+extern void storeCachedDevices(const sdrplay_api_DeviceT *devs, unsigned int nDevs);
+extern void invalidateCachedDevices(void);
+extern double getCacheTtl(const SoapySDR::Kwargs &args);
+extern int getCachedDeviceIndex(const std::string &serial);
+extern int parseDeviceIndex(const std::string &str);
 
 SoapySDRPlay3::SoapySDRPlay3(const SoapySDR::Kwargs &args)
 {
-    std::string label = args.at("label");
+    // the device is selected by serial number, or else by the index in
+    // its label
+    std::string serial;
+    if (args.count("serial") != 0) serial = args.at("serial");
+    int devIdx = -1;
+
+    if (serial.empty())
+    {
+        std::string label;
+        if (args.count("label") != 0) label = args.at("label");
 
-    std::string baseLabel = "SDRplay3 Dev";
+        std::string baseLabel = "SDRplay3 Dev";
 
-    size_t posidx = label.find(baseLabel);
+        size_t posidx = label.find(baseLabel);
 
-    if (posidx == std::string::npos)
-    {
-        SoapySDR_logf(SOAPY_SDR_WARNING, "Can't find Dev string in args");
-        throw std::runtime_error("Can't find Dev string in args");
+        if (posidx != std::string::npos)
+        {
+            // retrieve device index
+            devIdx = parseDeviceIndex(label.substr(posidx + baseLabel.length()));
+        }
+        if (devIdx < 0)
+        {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "Can't find Dev string in args");
+            throw std::runtime_error("Can't find Dev string in args");
+        }
     }
-    // retrieve device index
-    unsigned int devIdx = label.at(posidx + baseLabel.length()) - 0x30;
 
-    // retrieve hwVer and serNo by API
+    // retrieve hwVer and serNo by API, or from the enumeration cache if
+    // the devices have just been listed
+    sdrplay_api_DeviceT rspDevs[SDRPLAY_MAX_DEVICES];
     unsigned int nDevs = 0;
+    auto startTime = std::chrono::steady_clock::now();
 
     sdrplay_api_ErrT err;
 
-    if (isSdrplayApiOpen == false) {
-        sdrplay_api_ErrT err;
-        if ((err = sdrplay_api_Open()) != sdrplay_api_Success) {
-            return;
-        }
-        isSdrplayApiOpen = true;
+    if (!openSdrplayApi())
+    {
+        throw std::runtime_error("Open() failed");
     }
+    sdrplay_api_LockDeviceApi();
+    auto openTime = std::chrono::steady_clock::now();
 
-    sdrplay_api_GetDevices(&rspDevs[0], &nDevs, SDRPLAY_MAX_DEVICES);
+    std::vector<sdrplay_api_DeviceT> cachedDevs;
+    bool cached = getCachedDevices(cachedDevs, getCacheTtl(args));
+    if (cached)
+    {
+        nDevs = (unsigned int)cachedDevs.size();
+        std::copy(cachedDevs.begin(), cachedDevs.end(), rspDevs);
+    }
+    else
+    {
+        sdrplay_api_GetDevices(&rspDevs[0], &nDevs, SDRPLAY_MAX_DEVICES);
+        storeCachedDevices(rspDevs, nDevs);
+    }
+    if (!serial.empty())
+    {
+        devIdx = getCachedDeviceIndex(serial);
+        if (devIdx < 0 && cached)
+        {
+            // the device may have been attached since the devices were listed
+            sdrplay_api_GetDevices(&rspDevs[0], &nDevs, SDRPLAY_MAX_DEVICES);
+            storeCachedDevices(rspDevs, nDevs);
+            cached = false;
+            devIdx = getCachedDeviceIndex(serial);
+        }
+        if (devIdx < 0)
+        {
+            sdrplay_api_UnlockDeviceApi();
+            closeSdrplayApi();
+            SoapySDR_logf(SOAPY_SDR_WARNING, "Can't find device with serial number %s", serial.c_str());
+            throw std::runtime_error("Can't find device with serial number " + serial);
+        }
+    }
+    auto enumTime = std::chrono::steady_clock::now();
 
-    if (devIdx >= nDevs) {
+    if ((unsigned int)devIdx >= nDevs) {
+        sdrplay_api_UnlockDeviceApi();
+        closeSdrplayApi();
         SoapySDR_logf(SOAPY_SDR_WARNING, "Can't determine hwVer/serNo");
         throw std::runtime_error("Can't determine hwVer/serNo");
     }
@@ -73,6 +127,7 @@ SoapySDRPlay3::SoapySDRPlay3(const SoapySDR::Kwargs &args)
     if (err != sdrplay_api_Success)
     {
         sdrplay_api_UnlockDeviceApi();
+        closeSdrplayApi();
         SoapySDR_logf(SOAPY_SDR_ERROR, "ApiVersion Error: %s", sdrplay_api_GetErrorString(err));
         throw std::runtime_error("ApiVersion() failed");
     }
@@ -100,15 +155,35 @@ SoapySDRPlay3::SoapySDRPlay3(const SoapySDR::Kwargs &args)
         device.rspDuoMode = sdrplay_api_RspDuoMode_Unknown;
     }
     err = sdrplay_api_SelectDevice(&device);
+    if (err != sdrplay_api_Success && cached)
+    {
+        // the cached entry may be stale: list the devices again
+        SoapySDR_logf(SOAPY_SDR_DEBUG, "SelectDevice failed with the cached device list; listing the devices again");
+        invalidateCachedDevices();
+        sdrplay_api_GetDevices(&rspDevs[0], &nDevs, SDRPLAY_MAX_DEVICES);
+        storeCachedDevices(rspDevs, nDevs);
+        int newIdx = getCachedDeviceIndex(device.SerNo);
+        if (newIdx >= 0)
+        {
+            sdrplay_api_TunerSelectT tuner = device.tuner;
+            sdrplay_api_RspDuoModeT rspDuoMode = device.rspDuoMode;
+            device = rspDevs[newIdx];
+            device.tuner = tuner;
+            device.rspDuoMode = rspDuoMode;
+            err = sdrplay_api_SelectDevice(&device);
+        }
+    }
     if (err != sdrplay_api_Success)
     {
         sdrplay_api_UnlockDeviceApi();
+        closeSdrplayApi();
         SoapySDR_logf(SOAPY_SDR_ERROR, "SelectDevice Error: %s", sdrplay_api_GetErrorString(err));
         throw std::runtime_error("SelectDevice() failed");
         return;
     }
     sdrplay_api_UnlockDeviceApi();
-    deviceSelected = &device;
+    addSelectedDevice(&device);
+    auto selectTime = std::chrono::steady_clock::now();
 
     // Enable (= sdrplay_api_DbgLvl_Verbose) API calls tracing,
     // but only for debug purposes due to its performance impact.
@@ -117,17 +192,34 @@ SoapySDRPlay3::SoapySDRPlay3(const SoapySDR::Kwargs &args)
     err = sdrplay_api_GetDeviceParams(device.dev, &deviceParams);
     if (err != sdrplay_api_Success)
     {
+        sdrplay_api_ReleaseDevice(&device);
+        removeSelectedDevice(&device);
+        closeSdrplayApi();
         SoapySDR_logf(SOAPY_SDR_ERROR, "GetDeviceParams Error: %s", sdrplay_api_GetErrorString(err));
         throw std::runtime_error("GetDeviceParams() failed");
         return;
     }
     chParams = device.tuner == sdrplay_api_Tuner_B ? deviceParams->rxChannelB : deviceParams->rxChannelA;
 
+    // startup timing
+    auto paramsTime = std::chrono::steady_clock::now();
+    char timing[256];
+    snprintf(timing, sizeof(timing), "open_ms=%.3f,enumerate_ms=%.3f,cached=%d,select_ms=%.3f,params_ms=%.3f,total_ms=%.3f",
+             std::chrono::duration<double, std::milli>(openTime - startTime).count(),
+             std::chrono::duration<double, std::milli>(enumTime - openTime).count(),
+             cached ? 1 : 0,
+             std::chrono::duration<double, std::milli>(selectTime - enumTime).count(),
+             std::chrono::duration<double, std::milli>(paramsTime - selectTime).count(),
+             std::chrono::duration<double, std::milli>(paramsTime - startTime).count());
+    startupTiming = timing;
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "Startup timing: %s", timing);
+
     // set sample rate
     uint32_t sampleRate = 2000000;
     deviceParams->devParams->fsFreq.fsHz = sampleRate;
     reqSampleRate = sampleRate;
     chParams->ctrlParams.decimation.decimationFactor = 1;
+    decimationFactor = 1;
     chParams->ctrlParams.decimation.enable = 0;
     chParams->tunerParams.rfFreq.rfHz = 100000000;
     deviceParams->devParams->ppm = 0.0;
@@ -168,13 +260,111 @@ SoapySDRPlay3::SoapySDRPlay3(const SoapySDR::Kwargs &args)
 
     _bufA = 0;
     _bufB = 0;
+    nchannels = 1;
     useShort = true;
 
+    historySeconds = 0;
+    snapshotFile = "snapshot.cs16";
+
+    updateCalls = 0;
+    updateErrors = 0;
+    updateTimeNs = 0;
+    updateMaxNs = 0;
+    txnCommits = 0;
+    txnStagedUpdates = 0;
+    txnOpen = false;
+    txnThread = std::thread::id();
+    asyncControl = false;
+    ctrlRunning = false;
+    for (auto &slot : ctrlSlots)
+    {
+        slot.pending = false;
+        slot.engine = false;
+    }
+    ctrlRequests = 0;
+    ctrlSuperseded = 0;
+    ctrlCompleted = 0;
+    ctrlPending = 0;
+    hopping = false;
+    hopDwellSamples = 0;
+    hopDwellSeconds = 0.1;
+    hopIndex = 0;
+    hopDwellCount = 0;
+    hopSettling = false;
+    hopSettleCount = 0;
+    hopFrequency = 0.0;
+    hops = 0;
+    hopSettleTimeouts = 0;
+    hopSamplesDiscarded = 0;
+    sweeping = false;
+    sweepRunning = false;
+    sweepStart = 0.0;
+    sweepStop = 0.0;
+    sweepFftSize = DEFAULT_SWEEP_FFT_SIZE;
+    sweepAverages = DEFAULT_SWEEP_AVERAGES;
+    sweepOverlap = DEFAULT_SWEEP_OVERLAP;
+    sweepState = SWEEP_SETTLING;
+    sweepSettleCount = 0;
+    sweepCaptured = 0;
+    sweepStep = 0;
+    sweepSteps = 0;
+    sweepTrim = 0;
+    sweepBinHz = 0.0;
+    sweepTunedHz = 0.0;
+    sweepSpectrumStart = 0.0;
+    sweepSpectrumBinHz = 0.0;
+    sweepsCompleted = 0;
+    sweepSettleTimeouts = 0;
+    timeValid = false;
+    timeAnchorSample = 0;
+    timeAnchorNs = 0;
+    timeAnchorRate = 0;
+    timeNextSample = 0;
+    commandTimeNs = 0;
+    rfUpdatesIssued = 0;
+    rfChangesReported = 0;
+    grUpdatesIssued = 0;
+    grChangesReported = 0;
+    timedQueued = 0;
+    timedIssued = 0;
+    timedLanded = 0;
+    timedLastLandedNs = 0;
+    timedLastLandedSample = 0;
+    txnReason = sdrplay_api_Update_None;
+    txnReasonExt1 = sdrplay_api_Update_Ext1_None;
+    metricsFormat = "prometheus";
+    metricsInterval = 10.0;
+    metricsRunning = false;
+
     streamActive = false;
+    streamSetup = false;
+    standbyMode = false;
+    streamGated = false;
+
+    _snapshotSeq = 0;
+    publishSnapshot();
+
+    // a profile given at construction is in place before the stream is
+    // activated, so sdrplay_api_Init starts the device with it
+    if (args.count("profile") != 0)
+    {
+        try
+        {
+            loadProfile(args.at("profile"));
+        }
+        catch (const std::exception &e)
+        {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "profile: failed to load '%s': %s", args.at("profile").c_str(), e.what());
+        }
+    }
 }
 
 SoapySDRPlay3::~SoapySDRPlay3(void)
 {
+    stopMetricsWriter();
+    stopSweep();
+    stopControlThread();
+
     std::lock_guard <std::mutex> lock(_general_state_mutex);
 
     if (streamActive)
@@ -183,12 +373,10 @@ SoapySDRPlay3::~SoapySDRPlay3(void)
     }
     streamActive = false;
     sdrplay_api_ReleaseDevice(&device);
-    deviceSelected = nullptr;
+    removeSelectedDevice(&device);
 
-    if (isSdrplayApiOpen == true) {
-        sdrplay_api_Close();
-        isSdrplayApiOpen = false;
-    }
+    // the API stays open while other instances use it
+    closeSdrplayApi();
 
     _bufA = 0;
     _bufB = 0;
@@ -289,7 +477,7 @@ void SoapySDRPlay3::setAntenna(const int direction, const size_t channel, const
 
             if (streamActive)
             {
-                sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp2_AmPortSelect, sdrplay_api_Update_Ext1_None);
+                updateDevice(sdrplay_api_Update_Rsp2_AmPortSelect, sdrplay_api_Update_Ext1_None);
             }
         }
 
@@ -303,14 +491,14 @@ void SoapySDRPlay3::setAntenna(const int direction, const size_t channel, const
 
                 if (streamActive)
                 {
-                    sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp2_AmPortSelect, sdrplay_api_Update_RspDx_AntennaControl);
+                    updateDevice(sdrplay_api_Update_Rsp2_AmPortSelect, sdrplay_api_Update_RspDx_AntennaControl);
                 }
             }
             else
             {
                 if (streamActive)
                 {
-                    sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp2_AntennaControl, sdrplay_api_Update_RspDx_AntennaControl);
+                    updateDevice(sdrplay_api_Update_Rsp2_AntennaControl, sdrplay_api_Update_RspDx_AntennaControl);
                 }
             }
         }
@@ -336,7 +524,8 @@ void SoapySDRPlay3::setAntenna(const int direction, const size_t channel, const
                 changeToTuner1_2 = true;
             }
         }
-        else if (name == "Tuner 1 HiZ")
+        // "Tuner 1 Hi-Z" is the name listAntennas() and getAntenna() give
+        else if (name == "Tuner 1 Hi-Z" || name == "Tuner 1 HiZ")
         {
             chParams->rspDuoTunerParams.tuner1AmPortSel = sdrplay_api_RspDuo_AMPORT_1;
             if (device.tuner != sdrplay_api_Tuner_A)
@@ -354,48 +543,21 @@ void SoapySDRPlay3::setAntenna(const int direction, const size_t channel, const
 
         if (streamActive)
         {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_RspDuo_AmPortSelect, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_RspDuo_AmPortSelect, sdrplay_api_Update_Ext1_None);
         }
     }
+
+    publishSnapshot();
 }
 
 std::string SoapySDRPlay3::getAntenna(const int direction, const size_t channel) const
 {
-    std::lock_guard <std::mutex> lock(_general_state_mutex);
-
     if (direction == SOAPY_SDR_TX)
     {
         return "";
     }
 
-    if (device.hwVer == SDRPLAY_RSP2_ID)
-    {
-        if (chParams->rsp2TunerParams.amPortSel == sdrplay_api_Rsp2_AMPORT_1) {
-            return "Hi-Z";
-        }
-        else if (chParams->rsp2TunerParams.antennaSel == sdrplay_api_Rsp2_ANTENNA_A) {
-            return "Antenna A";
-        }
-        else {
-            return "Antenna B";  
-        }
-    }
-    else if (device.hwVer == SDRPLAY_RSPduo_ID)
-    {
-        if (chParams->rspDuoTunerParams.tuner1AmPortSel == sdrplay_api_RspDuo_AMPORT_1) {
-            return "Tuner 1 Hi-Z";
-        }
-        else if (device.tuner == sdrplay_api_Tuner_A) {
-            return "Tuner 1 50 ohm";
-        }
-        else {
-            return "Tuner 2 50 ohm";  
-        }
-    }
-    else
-    {
-        return "RX";
-    }
+    return readSnapshot().antenna;
 }
 
 /*******************************************************************
@@ -414,13 +576,13 @@ void SoapySDRPlay3::setDCOffsetMode(const int direction, const size_t channel, c
     //enable/disable automatic DC removal
     chParams->ctrlParams.dcOffset.DCenable = (unsigned char)automatic;
     chParams->ctrlParams.dcOffset.IQenable = (unsigned char)automatic;
+
+    publishSnapshot();
 }
 
 bool SoapySDRPlay3::getDCOffsetMode(const int direction, const size_t channel) const
 {
-    std::lock_guard <std::mutex> lock(_general_state_mutex);
-
-    return (bool)chParams->ctrlParams.dcOffset.DCenable;
+    return readSnapshot().dcOffset;
 }
 
 bool SoapySDRPlay3::hasDCOffset(const int direction, const size_t channel) const
@@ -459,19 +621,45 @@ void SoapySDRPlay3::setGainMode(const int direction, const size_t channel, const
     if (automatic == true) {
         chParams->ctrlParams.agc.enable = sdrplay_api_AGC_100HZ;
     }
+
+    publishSnapshot();
 }
 
 bool SoapySDRPlay3::getGainMode(const int direction, const size_t channel) const
 {
-    std::lock_guard <std::mutex> lock(_general_state_mutex);
-
-    return (chParams->ctrlParams.agc.enable == sdrplay_api_AGC_DISABLE)? false: true;
+    return readSnapshot().agcEnabled;
 }
 
 void SoapySDRPlay3::setGain(const int direction, const size_t channel, const std::string &name, const double value)
 {
+   long long timeNs = commandTimeNs;
+   if (timeNs != 0 && (name == "IFGR" || name == "RFGR"))
+   {
+      queueTimedControl(name == "IFGR" ? CONTROL_IFGR : CONTROL_RFGR, value, timeNs);
+      return;
+   }
+
+   if (asyncControl && (name == "IFGR" || name == "RFGR"))
+   {
+      queueControl(name == "IFGR" ? CONTROL_IFGR : CONTROL_RFGR, value, false);
+      return;
+   }
+
     std::lock_guard <std::mutex> lock(_general_state_mutex);
 
+   sdrplay_api_ReasonForUpdateT reason = applyGain(name, value);
+   if ((reason != sdrplay_api_Update_None) && (streamActive))
+   {
+      updateDevice(reason, sdrplay_api_Update_Ext1_None);
+   }
+
+    publishSnapshot();
+}
+
+// changes chParams and returns the reason for update (if any); the caller
+// holds _general_state_mutex
+sdrplay_api_ReasonForUpdateT SoapySDRPlay3::applyGain(const std::string &name, const double value)
+{
    bool doUpdate = false;
 
    if (name == "IFGR")
@@ -493,23 +681,18 @@ void SoapySDRPlay3::setGain(const int direction, const size_t channel, const std
           doUpdate = true;
       }
    }
-   if ((doUpdate == true) && (streamActive))
-   {
-      sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Tuner_Gr, sdrplay_api_Update_Ext1_None);
-   }
+   return doUpdate ? sdrplay_api_Update_Tuner_Gr : sdrplay_api_Update_None;
 }
 
 double SoapySDRPlay3::getGain(const int direction, const size_t channel, const std::string &name) const
 {
-    std::lock_guard <std::mutex> lock(_general_state_mutex);
-
    if (name == "IFGR")
    {
-       return chParams->tunerParams.gain.gainVals.curr;
+       return readSnapshot().ifGain;
    }
    else if (name == "RFGR")
    {
-      return chParams->tunerParams.gain.LNAstate;
+      return readSnapshot().lnaState;
    }
 
    return 0;
@@ -550,40 +733,61 @@ void SoapySDRPlay3::setFrequency(const int direction,
                                  const double frequency,
                                  const SoapySDR::Kwargs &args)
 {
+   if (direction != SOAPY_SDR_RX)
+   {
+      return;
+   }
+
+   long long timeNs = commandTimeNs;
+   if (timeNs != 0 && (name == "RF" || name == "CORR"))
+   {
+      queueTimedControl(name == "RF" ? CONTROL_RF : CONTROL_CORR, frequency, timeNs);
+      return;
+   }
+
+   if (asyncControl && (name == "RF" || name == "CORR"))
+   {
+      queueControl(name == "RF" ? CONTROL_RF : CONTROL_CORR, frequency, false);
+      return;
+   }
+
     std::lock_guard <std::mutex> lock(_general_state_mutex);
 
-   if (direction == SOAPY_SDR_RX)
+   sdrplay_api_ReasonForUpdateT reason = applyFrequency(name, frequency);
+   if ((reason != sdrplay_api_Update_None) && (streamActive))
    {
-      if ((name == "RF") && (chParams->tunerParams.rfFreq.rfHz != (uint32_t)frequency))
-      {
-         chParams->tunerParams.rfFreq.rfHz = (uint32_t)frequency;
-         if (streamActive)
-         {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Tuner_Frf, sdrplay_api_Update_Ext1_None);
-         }
-      }
-      else if ((name == "CORR") && (deviceParams->devParams->ppm != frequency))
-      {
-         deviceParams->devParams->ppm = frequency;
-         if (streamActive)
-         {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Dev_Ppm, sdrplay_api_Update_Ext1_None);
-         }
-      }
+      updateDevice(reason, sdrplay_api_Update_Ext1_None);
    }
+
+    publishSnapshot();
 }
 
-double SoapySDRPlay3::getFrequency(const int direction, const size_t channel, const std::string &name) const
+// changes chParams/deviceParams and returns the reason for update (if
+// any); the caller holds _general_state_mutex
+sdrplay_api_ReasonForUpdateT SoapySDRPlay3::applyFrequency(const std::string &name, const double frequency)
 {
-    std::lock_guard <std::mutex> lock(_general_state_mutex);
+   if ((name == "RF") && (chParams->tunerParams.rfFreq.rfHz != (uint32_t)frequency))
+   {
+      chParams->tunerParams.rfFreq.rfHz = (uint32_t)frequency;
+      return sdrplay_api_Update_Tuner_Frf;
+   }
+   else if ((name == "CORR") && (deviceParams->devParams->ppm != frequency))
+   {
+      deviceParams->devParams->ppm = frequency;
+      return sdrplay_api_Update_Dev_Ppm;
+   }
+   return sdrplay_api_Update_None;
+}
 
+double SoapySDRPlay3::getFrequency(const int direction, const size_t channel, const std::string &name) const
+{
     if (name == "RF")
     {
-        return (double)chParams->tunerParams.rfFreq.rfHz;
+        return readSnapshot().rfHz;
     }
     else if (name == "CORR")
     {
-        return deviceParams->devParams->ppm;
+        return readSnapshot().ppm;
     }
 
     return 0;
@@ -626,35 +830,53 @@ void SoapySDRPlay3::setSampleRate(const int direction, const size_t channel, con
 
     if (direction == SOAPY_SDR_RX)
     {
+       // the sweep step geometry is worked out from the sample rate
+       std::lock_guard <std::mutex> sweepLock(_sweep_mutex);
+       if (sweepRunning)
+       {
+          SoapySDR_log(SOAPY_SDR_ERROR, "sample rate: cannot be changed while sweeping");
+          return;
+       }
+
        reqSampleRate = (uint32_t)rate;
 
        unsigned int decM;
        unsigned int decEnable;
-       uint32_t sampleRate = getInputSampleRateAndDecimation(reqSampleRate, &decM, &decEnable, chParams->tunerParams.ifType);
        chParams->tunerParams.bwType = getBwEnumForRate(rate, chParams->tunerParams.ifType);
+       uint32_t sampleRate = getInputSampleRateAndDecimation(reqSampleRate, &decM, &decEnable, chParams->tunerParams.ifType, getBwValueFromEnum(chParams->tunerParams.bwType));
 
        if ((sampleRate != deviceParams->devParams->fsFreq.fsHz) || (decM != chParams->ctrlParams.decimation.decimationFactor) || (reqSampleRate != sampleRate))
        {
+          bool fsChanged = (sampleRate != deviceParams->devParams->fsFreq.fsHz);
           deviceParams->devParams->fsFreq.fsHz = sampleRate;
           chParams->ctrlParams.decimation.enable = decEnable;
           chParams->ctrlParams.decimation.decimationFactor = decM;
+          decimationFactor = decM;
           if (chParams->tunerParams.ifType == sdrplay_api_IF_Zero) {
               chParams->ctrlParams.decimation.wideBandSignal = 1;
           }
           else {
               chParams->ctrlParams.decimation.wideBandSignal = 0;
           }
-          if (_bufA) { _bufA->reset = true; }
-          if (_bufB) { _bufB->reset = true; }
+          // a change of fsHz is reported by the stream callback when it
+          // lands; a decimation change is applied by the API right away
+          if (!fsChanged)
+          {
+             if (_bufA) { _bufA->pendingChanges |= SOAPY_SDRPLAY_RATE_CHANGED; }
+             if (_bufB) { _bufB->pendingChanges |= SOAPY_SDRPLAY_RATE_CHANGED; }
+          }
+          if (historySeconds > 0) { resizeHistory(); }
           if (streamActive)
           {
              // beware that when the fs change crosses the boundary between
              // 2,685,312 and 2,685,313 the rx_callbacks stop for some
              // reason
-             sdrplay_api_Update(device.dev, device.tuner, (sdrplay_api_ReasonForUpdateT) (sdrplay_api_Update_Dev_Fs | sdrplay_api_Update_Ctrl_Decimation), sdrplay_api_Update_Ext1_None);
+             updateDevice((sdrplay_api_ReasonForUpdateT) (sdrplay_api_Update_Dev_Fs | sdrplay_api_Update_Ctrl_Decimation), sdrplay_api_Update_Ext1_None);
           }
        }
     }
+
+    publishSnapshot();
 }
 
 double SoapySDRPlay3::getSampleRate(const int direction, const size_t channel) const
@@ -662,48 +884,107 @@ double SoapySDRPlay3::getSampleRate(const int direction, const size_t channel) c
    return reqSampleRate;
 }
 
+/*******************************************************************
+ * Sample rate planner
+ *
+ * Each row is a way for the API to deliver a sample rate in an IF mode:
+ * the ADC runs at fs (that is also the rate of the samples over USB) and
+ * the API decimates by decM. The planner takes the row that delivers the
+ * requested rate exactly with the lowest fs that still covers the IF
+ * bandwidth, then the lowest decimation.
+ ******************************************************************/
+
+struct RatePlan
+{
+    sdrplay_api_If_kHzT ifType;
+    double fsMin;
+    double fsMax;
+    unsigned int decM;
+};
+
+static const RatePlan ratePlans[] = {
+    // zero IF: any ADC rate
+    { sdrplay_api_IF_Zero,  2000000, 10660000, 1 },
+    { sdrplay_api_IF_Zero,  2000000, 10660000, 2 },
+    { sdrplay_api_IF_Zero,  2000000, 10660000, 4 },
+    { sdrplay_api_IF_Zero,  2000000, 10660000, 8 },
+    { sdrplay_api_IF_Zero,  2000000, 10660000, 16 },
+    { sdrplay_api_IF_Zero,  2000000, 10660000, 32 },
+    // low IF: the ADC rate is tied to the IF
+    { sdrplay_api_IF_0_450, 2000000, 2000000,  2 },
+    { sdrplay_api_IF_0_450, 2000000, 2000000,  4 },
+    { sdrplay_api_IF_1_620, 6000000, 6000000,  4 },
+    { sdrplay_api_IF_1_620, 6000000, 6000000,  8 },
+    { sdrplay_api_IF_2_048, 8192000, 8192000,  4 },
+};
+
+// the rates offered by listSampleRates(), where the IF mode has a plan
+static const uint32_t listedRates[] = {
+    62500, 125000, 250000, 300000, 500000, 600000, 750000, 1000000,
+    1500000, 2000000, 2048000, 3000000, 4000000, 5000000, 6000000,
+    7000000, 8000000, 9000000, 10000000,
+};
+
+// 0 if the IF mode can't deliver the rate; a row whose fs is below the
+// bandwidth is only taken when no row covers it
+static const RatePlan *findRatePlan(uint32_t rate, sdrplay_api_If_kHzT ifType, double bandwidth)
+{
+   const RatePlan *best = 0;
+   for (const RatePlan &plan : ratePlans)
+   {
+      double fs = (double)rate * plan.decM;
+      if (plan.ifType != ifType || fs < plan.fsMin || fs > plan.fsMax)
+      {
+         continue;
+      }
+      if (!best)
+      {
+         best = &plan;
+         continue;
+      }
+      double bestFs = (double)rate * best->decM;
+      bool covers = fs >= bandwidth;
+      bool bestCovers = bestFs >= bandwidth;
+      if ((covers && !bestCovers) || (covers == bestCovers && fs < bestFs))
+      {
+         best = &plan;
+      }
+   }
+   return best;
+}
+
 std::vector<double> SoapySDRPlay3::listSampleRates(const int direction, const size_t channel) const
 {
     std::vector<double> rates;
 
-    rates.push_back(250000);
-    rates.push_back(500000);
-    rates.push_back(1000000);
-    rates.push_back(2000000);
-    rates.push_back(2048000);
-    rates.push_back(3000000);
-    rates.push_back(4000000);
-    rates.push_back(5000000);
-    rates.push_back(6000000);
-    rates.push_back(7000000);
-    rates.push_back(8000000);
-    rates.push_back(9000000);
-    rates.push_back(10000000);
-    
+    sdrplay_api_If_kHzT ifType = readSnapshot().ifType;
+    for (uint32_t rate : listedRates)
+    {
+        if (findRatePlan(rate, ifType, 0))
+        {
+            rates.push_back(rate);
+        }
+    }
+
     return rates;
 }
 
-uint32_t SoapySDRPlay3::getInputSampleRateAndDecimation(uint32_t rate, unsigned int *decM, unsigned int *decEnable, sdrplay_api_If_kHzT ifType)
+uint32_t SoapySDRPlay3::getInputSampleRateAndDecimation(uint32_t rate, unsigned int *decM, unsigned int *decEnable, sdrplay_api_If_kHzT ifType, double bandwidth)
 {
-   if (ifType == sdrplay_api_IF_2_048)
-   {
-      if      (rate == 2048000) { *decM = 4; *decEnable = 1; return 8192000; }
-   }
-   else if (ifType == sdrplay_api_IF_0_450)
+   const RatePlan *best = findRatePlan(rate, ifType, bandwidth);
+   if (best)
    {
-      if      (rate == 1000000) { *decM = 2; *decEnable = 1; return 2000000; }
-      else if (rate == 500000)  { *decM = 4; *decEnable = 1; return 2000000; }
-   }
-   else if (ifType == sdrplay_api_IF_Zero)
-   {
-
-      if      ((rate >= 200000)  && (rate < 500000))  { *decM = 8; *decEnable = 1; return 2000000; }
-      else if ((rate >= 500000)  && (rate < 1000000)) { *decM = 4; *decEnable = 1; return 2000000; }
-      else if ((rate >= 1000000) && (rate < 2000000)) { *decM = 2; *decEnable = 1; return 2000000; }
-      else                                            { *decM = 1; *decEnable = 0; return rate; }
+      if ((double)rate * best->decM < bandwidth)
+      {
+         SoapySDR_logf(SOAPY_SDR_WARNING, "No ADC rate for %u S/s in IF mode %s covers the %.0f Hz IF bandwidth", rate, IFtoString(ifType).c_str(), bandwidth);
+      }
+      *decM = best->decM;
+      *decEnable = (best->decM > 1) ? 1 : 0;
+      return rate * best->decM;
    }
 
    // this is invalid, but return something
+   SoapySDR_logf(SOAPY_SDR_WARNING, "No sample rate plan for %u S/s in IF mode %s", rate, IFtoString(ifType).c_str());
    *decM = 1; *decEnable = 0; return rate;
 }
 
@@ -720,21 +1001,43 @@ void SoapySDRPlay3::setBandwidth(const int direction, const size_t channel, cons
       if (getBwValueFromEnum(chParams->tunerParams.bwType) != bw_in)
       {
          chParams->tunerParams.bwType = sdrPlayGetBwMhzEnum(bw_in);
+         int reason = sdrplay_api_Update_Tuner_BwType;
+
+         // the ADC rate has to cover the IF filter: a wider one may need a
+         // higher fs (and decimation) for the same sample rate
+         unsigned int decM;
+         unsigned int decEnable;
+         uint32_t sampleRate = getInputSampleRateAndDecimation(reqSampleRate, &decM, &decEnable, chParams->tunerParams.ifType, getBwValueFromEnum(chParams->tunerParams.bwType));
+         if ((sampleRate != deviceParams->devParams->fsFreq.fsHz) || (decM != chParams->ctrlParams.decimation.decimationFactor))
+         {
+            bool fsChanged = (sampleRate != deviceParams->devParams->fsFreq.fsHz);
+            deviceParams->devParams->fsFreq.fsHz = sampleRate;
+            chParams->ctrlParams.decimation.enable = decEnable;
+            chParams->ctrlParams.decimation.decimationFactor = decM;
+            decimationFactor = decM;
+            chParams->ctrlParams.decimation.wideBandSignal = (chParams->tunerParams.ifType == sdrplay_api_IF_Zero) ? 1 : 0;
+            if (!fsChanged)
+            {
+               if (_bufA) { _bufA->pendingChanges |= SOAPY_SDRPLAY_RATE_CHANGED; }
+               if (_bufB) { _bufB->pendingChanges |= SOAPY_SDRPLAY_RATE_CHANGED; }
+            }
+            reason |= sdrplay_api_Update_Dev_Fs | sdrplay_api_Update_Ctrl_Decimation;
+         }
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Tuner_BwType, sdrplay_api_Update_Ext1_None);
+            updateDevice((sdrplay_api_ReasonForUpdateT)reason, sdrplay_api_Update_Ext1_None);
          }
       }
    }
+
+    publishSnapshot();
 }
 
 double SoapySDRPlay3::getBandwidth(const int direction, const size_t channel) const
 {
-    std::lock_guard <std::mutex> lock(_general_state_mutex);
-
    if (direction == SOAPY_SDR_RX)
    {
-      return getBwValueFromEnum(chParams->tunerParams.bwType);
+      return readSnapshot().bandwidth;
    }
    return 0;
 }
@@ -778,32 +1081,47 @@ double SoapySDRPlay3::getRateForBwEnum(sdrplay_api_Bw_MHzT bwEnum)
 }
 
 
+// the widest IF filter for a sample rate: each row is the lowest rate
+// at which a filter can be used in an IF mode
+struct BwPlan
+{
+    sdrplay_api_If_kHzT ifType;
+    double minRate;
+    sdrplay_api_Bw_MHzT bwType;
+};
+
+static const BwPlan bwPlans[] = {
+    { sdrplay_api_IF_Zero,        0, sdrplay_api_BW_0_200 },
+    { sdrplay_api_IF_Zero,   300000, sdrplay_api_BW_0_300 },
+    { sdrplay_api_IF_Zero,   600000, sdrplay_api_BW_0_600 },
+    { sdrplay_api_IF_Zero,  1536000, sdrplay_api_BW_1_536 },
+    { sdrplay_api_IF_Zero,  5000000, sdrplay_api_BW_5_000 },
+    { sdrplay_api_IF_Zero,  6000000, sdrplay_api_BW_6_000 },
+    { sdrplay_api_IF_Zero,  7000000, sdrplay_api_BW_7_000 },
+    { sdrplay_api_IF_Zero,  8000000, sdrplay_api_BW_8_000 },
+    { sdrplay_api_IF_0_450,       0, sdrplay_api_BW_0_200 },
+    { sdrplay_api_IF_0_450,  500000, sdrplay_api_BW_0_300 },
+    { sdrplay_api_IF_0_450, 1000000, sdrplay_api_BW_0_600 },
+    { sdrplay_api_IF_1_620,       0, sdrplay_api_BW_0_200 },
+    { sdrplay_api_IF_1_620,  500000, sdrplay_api_BW_0_300 },
+    { sdrplay_api_IF_1_620, 1000000, sdrplay_api_BW_0_600 },
+    { sdrplay_api_IF_2_048,       0, sdrplay_api_BW_0_200 },
+    { sdrplay_api_IF_2_048,  500000, sdrplay_api_BW_0_300 },
+    { sdrplay_api_IF_2_048, 1000000, sdrplay_api_BW_0_600 },
+    { sdrplay_api_IF_2_048, 1536000, sdrplay_api_BW_1_536 },
+};
+
 sdrplay_api_Bw_MHzT SoapySDRPlay3::getBwEnumForRate(double rate, sdrplay_api_If_kHzT ifType)
 {
-   if (ifType == sdrplay_api_IF_Zero)
-   {
-      if      ((rate >= 200000)  && (rate < 300000))  return sdrplay_api_BW_0_200;
-      else if ((rate >= 300000)  && (rate < 600000))  return sdrplay_api_BW_0_300;
-      else if ((rate >= 600000)  && (rate < 1536000)) return sdrplay_api_BW_0_600;
-      else if ((rate >= 1536000) && (rate < 5000000)) return sdrplay_api_BW_1_536;
-      else if ((rate >= 5000000) && (rate < 6000000)) return sdrplay_api_BW_5_000;
-      else if ((rate >= 6000000) && (rate < 7000000)) return sdrplay_api_BW_6_000;
-      else if ((rate >= 7000000) && (rate < 8000000)) return sdrplay_api_BW_7_000;
-      else                                            return sdrplay_api_BW_8_000;
-   }
-   else if ((ifType == sdrplay_api_IF_0_450) || (ifType == sdrplay_api_IF_1_620))
-   {
-      if      ((rate >= 200000)  && (rate < 500000))  return sdrplay_api_BW_0_200;
-      else if ((rate >= 500000)  && (rate < 1000000)) return sdrplay_api_BW_0_300;
-      else                                            return sdrplay_api_BW_0_600;
-   }
-   else
+   sdrplay_api_Bw_MHzT bwType = sdrplay_api_BW_0_200;
+   for (const BwPlan &plan : bwPlans)
    {
-      if      ((rate >= 200000)  && (rate < 500000))  return sdrplay_api_BW_0_200;
-      else if ((rate >= 500000)  && (rate < 1000000)) return sdrplay_api_BW_0_300;
-      else if ((rate >= 1000000) && (rate < 1536000)) return sdrplay_api_BW_0_600;
-      else                                            return sdrplay_api_BW_1_536;
+      if (plan.ifType == ifType && rate >= plan.minRate)
+      {
+         bwType = plan.bwType;
+      }
    }
+   return bwType;
 }
 
 
@@ -957,6 +1275,14 @@ SoapySDR::ArgInfoList SoapySDRPlay3::getSettingInfo(void) const
        RspDuoMode.options.push_back("Tuner B (Master/Slave)");
        RspDuoMode.options.push_back("Dual Tuner");
        setArgs.push_back(RspDuoMode);
+
+       SoapySDR::ArgInfo RspDuoSwitchTimingArg;
+       RspDuoSwitchTimingArg.key = "rspduo_switch_timing";
+       RspDuoSwitchTimingArg.value = "";
+       RspDuoSwitchTimingArg.name = "RSP Duo Switch Timing";
+       RspDuoSwitchTimingArg.description = "Time spent in each step of the last RSP Duo mode switch (read only)";
+       RspDuoSwitchTimingArg.type = SoapySDR::ArgInfo::STRING;
+       setArgs.push_back(RspDuoSwitchTimingArg);
     }
 
 #ifdef RF_GAIN_IN_MENU
@@ -1151,11 +1477,295 @@ SoapySDR::ArgInfoList SoapySDRPlay3::getSettingInfo(void) const
        setArgs.push_back(DabNotchArg);
     }
 
+    SoapySDR::ArgInfo HistoryArg;
+    HistoryArg.key = "history_seconds";
+    HistoryArg.value = "0";
+    HistoryArg.name = "History Length";
+    HistoryArg.description = "Length of the pre-trigger history ring in seconds (0 = disabled)";
+    HistoryArg.units = "s";
+    HistoryArg.type = SoapySDR::ArgInfo::FLOAT;
+    setArgs.push_back(HistoryArg);
+
+    SoapySDR::ArgInfo SnapshotFileArg;
+    SnapshotFileArg.key = "snapshot_file";
+    SnapshotFileArg.value = "snapshot.cs16";
+    SnapshotFileArg.name = "Snapshot File";
+    SnapshotFileArg.description = "File written by the 'snapshot' setting (interleaved CS16)";
+    SnapshotFileArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(SnapshotFileArg);
+
+    SoapySDR::ArgInfo SnapshotArg;
+    SnapshotArg.key = "snapshot";
+    SnapshotArg.value = "";
+    SnapshotArg.name = "Snapshot";
+    SnapshotArg.description = "Write history samples '<first>,<last>[,<channel>]' (hardware sample numbers, <last> excluded) to the snapshot file";
+    SnapshotArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(SnapshotArg);
+
+    SoapySDR::ArgInfo RatePlanArg;
+    RatePlanArg.key = "rate_plan";
+    RatePlanArg.value = "";
+    RatePlanArg.name = "Rate Plan";
+    RatePlanArg.description = "ADC rate, decimation, sample rate and IF bandwidth in use (read only)";
+    RatePlanArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(RatePlanArg);
+
+    SoapySDR::ArgInfo ProfileSaveArg;
+    ProfileSaveArg.key = "profile_save";
+    ProfileSaveArg.value = "";
+    ProfileSaveArg.name = "Save Profile";
+    ProfileSaveArg.description = "Save the tunable state of the device to this file";
+    ProfileSaveArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(ProfileSaveArg);
+
+    SoapySDR::ArgInfo ProfileLoadArg;
+    ProfileLoadArg.key = "profile_load";
+    ProfileLoadArg.value = "";
+    ProfileLoadArg.name = "Load Profile";
+    ProfileLoadArg.description = "Apply the tunable state saved in this file with a single device update";
+    ProfileLoadArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(ProfileLoadArg);
+
+    SoapySDR::ArgInfo RecordFileArg;
+    RecordFileArg.key = "record_file";
+    RecordFileArg.value = "";
+    RecordFileArg.name = "Record File";
+    RecordFileArg.description = "Record losslessly compressed I/Q samples to this file (empty = stop)";
+    RecordFileArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(RecordFileArg);
+
+    SoapySDR::ArgInfo MetricsFormatArg;
+    MetricsFormatArg.key = "metrics_format";
+    MetricsFormatArg.value = "prometheus";
+    MetricsFormatArg.name = "Metrics Format";
+    MetricsFormatArg.description = "Format of the 'metrics' setting and file";
+    MetricsFormatArg.type = SoapySDR::ArgInfo::STRING;
+    MetricsFormatArg.options.push_back("prometheus");
+    MetricsFormatArg.options.push_back("json");
+    setArgs.push_back(MetricsFormatArg);
+
+    SoapySDR::ArgInfo MetricsFileArg;
+    MetricsFileArg.key = "metrics_file";
+    MetricsFileArg.value = "";
+    MetricsFileArg.name = "Metrics File";
+    MetricsFileArg.description = "Write the metrics periodically to this file (empty = disabled)";
+    MetricsFileArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(MetricsFileArg);
+
+    SoapySDR::ArgInfo MetricsIntervalArg;
+    MetricsIntervalArg.key = "metrics_interval";
+    MetricsIntervalArg.value = "10";
+    MetricsIntervalArg.name = "Metrics Interval";
+    MetricsIntervalArg.description = "Interval between writes of the metrics file";
+    MetricsIntervalArg.units = "s";
+    MetricsIntervalArg.type = SoapySDR::ArgInfo::FLOAT;
+    setArgs.push_back(MetricsIntervalArg);
+
+    SoapySDR::ArgInfo LatencyArg;
+    LatencyArg.key = "latency_histogram";
+    LatencyArg.value = "";
+    LatencyArg.name = "Latency Histogram";
+    LatencyArg.description = "Read the buffer queueing latency histogram; write 'reset' to clear it";
+    LatencyArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(LatencyArg);
+
+    SoapySDR::ArgInfo CadenceArg;
+    CadenceArg.key = "callback_cadence";
+    CadenceArg.value = "";
+    CadenceArg.name = "Callback Cadence";
+    CadenceArg.description = "Read the stream callback interval and size histograms and stall count; write 'reset' to clear them";
+    CadenceArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(CadenceArg);
+
+    SoapySDR::ArgInfo TxnArg;
+    TxnArg.key = "txn";
+    TxnArg.value = "commit";
+    TxnArg.name = "Settings Transaction";
+    TxnArg.description = "Between 'begin' and 'commit' the setting changes made by the same thread are applied with a single device update; 'abort' closes the transaction without one. Other threads cannot begin, commit or abort while it is open";
+    TxnArg.type = SoapySDR::ArgInfo::STRING;
+    TxnArg.options.push_back("begin");
+    TxnArg.options.push_back("commit");
+    TxnArg.options.push_back("abort");
+    setArgs.push_back(TxnArg);
+
+    SoapySDR::ArgInfo UpdateLatencyArg;
+    UpdateLatencyArg.key = "update_latency";
+    UpdateLatencyArg.value = "";
+    UpdateLatencyArg.name = "Update Latency";
+    UpdateLatencyArg.description = "Histogram of the device update durations (read only)";
+    UpdateLatencyArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(UpdateLatencyArg);
+
+    SoapySDR::ArgInfo StartupTimingArg;
+    StartupTimingArg.key = "startup_timing";
+    StartupTimingArg.value = "";
+    StartupTimingArg.name = "Startup Timing";
+    StartupTimingArg.description = "Time spent in each step of opening the device (read only)";
+    StartupTimingArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(StartupTimingArg);
+
+    SoapySDR::ArgInfo TimedCommandsArg;
+    TimedCommandsArg.key = "timed_commands";
+    TimedCommandsArg.value = "";
+    TimedCommandsArg.name = "Timed Commands";
+    TimedCommandsArg.description = "Counters of the timed commands, where the last one landed and the histogram of the landing errors (read only)";
+    TimedCommandsArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(TimedCommandsArg);
+
+    SoapySDR::ArgInfo StandbyModeArg;
+    StandbyModeArg.key = "standby_mode";
+    StandbyModeArg.value = "false";
+    StandbyModeArg.name = "Standby Mode";
+    StandbyModeArg.description = "Keep the device streaming when the stream is deactivated, so that it can be reactivated right away";
+    StandbyModeArg.type = SoapySDR::ArgInfo::BOOL;
+    setArgs.push_back(StandbyModeArg);
+
+    SoapySDR::ArgInfo AsyncControlArg;
+    AsyncControlArg.key = "async_control";
+    AsyncControlArg.value = "false";
+    AsyncControlArg.name = "Async Control";
+    AsyncControlArg.description = "Apply frequency and gain changes from a control thread, latest value wins";
+    AsyncControlArg.type = SoapySDR::ArgInfo::BOOL;
+    setArgs.push_back(AsyncControlArg);
+
+    SoapySDR::ArgInfo HopListArg;
+    HopListArg.key = "hop_list";
+    HopListArg.value = "";
+    HopListArg.name = "Hop List";
+    HopListArg.description = "Comma separated frequencies (Hz) to hop through; empty to stop hopping";
+    HopListArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(HopListArg);
+
+    SoapySDR::ArgInfo HopDwellArg;
+    HopDwellArg.key = "hop_dwell";
+    HopDwellArg.value = "100ms";
+    HopDwellArg.name = "Hop Dwell";
+    HopDwellArg.description = "Dwell time on each hop, in samples or with an 'ms' or 's' suffix";
+    HopDwellArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(HopDwellArg);
+
+    SoapySDR::ArgInfo SweepArg;
+    SweepArg.key = "sweep";
+    SweepArg.value = "stop";
+    SweepArg.name = "Sweep";
+    SweepArg.description = "Start or stop the wideband sweep; the samples are not streamed while sweeping";
+    SweepArg.type = SoapySDR::ArgInfo::STRING;
+    SweepArg.options.push_back("start");
+    SweepArg.options.push_back("stop");
+    setArgs.push_back(SweepArg);
+
+    SoapySDR::ArgInfo SweepRangeArg;
+    SweepRangeArg.key = "sweep_range";
+    SweepRangeArg.value = "";
+    SweepRangeArg.name = "Sweep Range";
+    SweepRangeArg.description = "Sweep range '<start>,<stop>' in Hz";
+    SweepRangeArg.type = SoapySDR::ArgInfo::STRING;
+    setArgs.push_back(SweepRangeArg);
+
+    SoapySDR::ArgInfo SweepFftSizeArg;
+    SweepFftSizeArg.key = "sweep_fft_size";
+    SweepFftSizeArg.value = std::to_string(DEFAULT_SWEEP_FFT_SIZE);
+    SweepFftSizeArg.name = "Sweep FFT Size";
+    SweepFftSizeArg.description = "FFT size of each sweep step (power of two)";
+    SweepFftSizeArg.type = SoapySDR::ArgInfo::INT;
+    setArgs.push_back(SweepFftSizeArg);
+
+    SoapySDR::ArgInfo SweepAveragesArg;
+    SweepAveragesArg.key = "sweep_averages";
+    SweepAveragesArg.value = std::to_string(DEFAULT_SWEEP_AVERAGES);
+    SweepAveragesArg.name = "Sweep Averages";
+    SweepAveragesArg.description = "Number of FFTs averaged on each sweep step (1 to " + std::to_string(MAX_SWEEP_AVERAGES) + ")";
+    SweepAveragesArg.type = SoapySDR::ArgInfo::INT;
+    SweepAveragesArg.range = SoapySDR::Range(1, MAX_SWEEP_AVERAGES);
+    setArgs.push_back(SweepAveragesArg);
+
+    SoapySDR::ArgInfo SweepOverlapArg;
+    SweepOverlapArg.key = "sweep_overlap";
+    SweepOverlapArg.value = std::to_string(DEFAULT_SWEEP_OVERLAP);
+    SweepOverlapArg.name = "Sweep Overlap";
+    SweepOverlapArg.description = "Fraction of the bins trimmed from each band edge of a sweep step";
+    SweepOverlapArg.type = SoapySDR::ArgInfo::FLOAT;
+    setArgs.push_back(SweepOverlapArg);
+
     return setArgs;
 }
 
 void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &value)
 {
+   // the control thread takes _general_state_mutex, so it is started and
+   // stopped without holding it
+   if (key == "async_control")
+   {
+      asyncControl = (value == "true");
+      updateControlThread();
+      return;
+   }
+   else if (key == "hop_list")
+   {
+      if (sweeping)
+      {
+         SoapySDR_log(SOAPY_SDR_ERROR, "hop_list: a sweep is running");
+         return;
+      }
+      setHopList(value);
+      updateControlThread();
+      return;
+   }
+   else if (key == "sweep")
+   {
+      if (value == "start")
+      {
+         if (hopping)
+         {
+            SoapySDR_log(SOAPY_SDR_ERROR, "sweep: hopping is active");
+            return;
+         }
+         if (sweepStop <= sweepStart)
+         {
+            SoapySDR_log(SOAPY_SDR_ERROR, "sweep: invalid sweep_range");
+            return;
+         }
+         startSweep();
+      }
+      else
+      {
+         stopSweep();
+      }
+      updateControlThread();
+      return;
+   }
+   else if (key == "snapshot")
+   {
+      // the file is written without holding _general_state_mutex
+      writeSnapshot(value);
+      return;
+   }
+   else if (key == "profile_save")
+   {
+      saveProfile(value);
+      return;
+   }
+   else if (key == "profile_load")
+   {
+      // applied through the setters, which take _general_state_mutex
+      loadProfile(value);
+      return;
+   }
+   else if (key == "hop_dwell")
+   {
+      // samples, or time with an 'ms' or 's' suffix
+      char *end;
+      double dwell = std::strtod(value.c_str(), &end);
+      std::string units(end);
+      std::lock_guard <std::mutex> hopLock(_hop_mutex);
+      hopDwellSamples = 0;
+      hopDwellSeconds = 0.0;
+      if (units == "ms")     hopDwellSeconds = dwell / 1000.0;
+      else if (units == "s") hopDwellSeconds = dwell;
+      else                   hopDwellSamples = (unsigned long long)dwell;
+      return;
+   }
+
     std::lock_guard <std::mutex> lock(_general_state_mutex);
 
    if (device.hwVer == SDRPLAY_RSPduo_ID && key == "rspduo_mode")
@@ -1179,7 +1789,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
       
       if (chParams->ctrlParams.agc.enable == sdrplay_api_AGC_DISABLE)
       {
-         sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Tuner_Gr,sdrplay_api_Update_Ext1_None);
+         updateDevice(sdrplay_api_Update_Tuner_Gr,sdrplay_api_Update_Ext1_None);
       }
    }
    else
@@ -1191,15 +1801,24 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          chParams->tunerParams.ifType = stringToIF(value);
          unsigned int decM;
          unsigned int decEnable;
-         uint32_t sampleRate = getInputSampleRateAndDecimation(reqSampleRate, &decM, &decEnable, chParams->tunerParams.ifType);
-         deviceParams->devParams->fsFreq.fsHz = sampleRate;
          chParams->tunerParams.bwType = getBwEnumForRate(reqSampleRate, chParams->tunerParams.ifType);
+         uint32_t sampleRate = getInputSampleRateAndDecimation(reqSampleRate, &decM, &decEnable, chParams->tunerParams.ifType, getBwValueFromEnum(chParams->tunerParams.bwType));
+         bool fsChanged = (sampleRate != deviceParams->devParams->fsFreq.fsHz);
+         deviceParams->devParams->fsFreq.fsHz = sampleRate;
          if (streamActive)
          {
             chParams->ctrlParams.decimation.enable = 0;
             chParams->ctrlParams.decimation.decimationFactor = 1;
             chParams->ctrlParams.decimation.wideBandSignal = 1;
-            sdrplay_api_Update(device.dev, device.tuner, (sdrplay_api_ReasonForUpdateT) (sdrplay_api_Update_Dev_Fs | sdrplay_api_Update_Tuner_BwType | sdrplay_api_Update_Tuner_IfType), sdrplay_api_Update_Ext1_None);
+            decimationFactor = 1;
+            // as in setSampleRate(): only a change of fsHz is reported by
+            // the stream callback
+            if (!fsChanged)
+            {
+               if (_bufA) { _bufA->pendingChanges |= SOAPY_SDRPLAY_RATE_CHANGED; }
+               if (_bufB) { _bufB->pendingChanges |= SOAPY_SDRPLAY_RATE_CHANGED; }
+            }
+            updateDevice((sdrplay_api_ReasonForUpdateT) (sdrplay_api_Update_Dev_Fs | sdrplay_api_Update_Tuner_BwType | sdrplay_api_Update_Tuner_IfType), sdrplay_api_Update_Ext1_None);
          }
       }
    }
@@ -1210,7 +1829,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
       chParams->ctrlParams.dcOffset.DCenable = 1;
       if (streamActive)
       {
-         sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Ctrl_DCoffsetIQimbalance, sdrplay_api_Update_Ext1_None);
+         updateDevice(sdrplay_api_Update_Ctrl_DCoffsetIQimbalance, sdrplay_api_Update_Ext1_None);
       }
    }
    else if (key == "agc_setpoint")
@@ -1218,7 +1837,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
       chParams->ctrlParams.agc.setPoint_dBfs = stoi(value);
       if (streamActive)
       {
-         sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Ctrl_Agc, sdrplay_api_Update_Ext1_None);
+         updateDevice(sdrplay_api_Update_Ctrl_Agc, sdrplay_api_Update_Ext1_None);
       }
    }
    else if (key == "extref_ctrl")
@@ -1231,7 +1850,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          deviceParams->devParams->rsp2Params.extRefOutputEn = extRef;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp2_ExtRefControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_Rsp2_ExtRefControl, sdrplay_api_Update_Ext1_None);
          }
       }
       if (device.hwVer == SDRPLAY_RSPduo_ID)
@@ -1239,7 +1858,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          deviceParams->devParams->rspDuoParams.extRefOutputEn = extRef;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_RspDuo_ExtRefControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_RspDuo_ExtRefControl, sdrplay_api_Update_Ext1_None);
          }
       }
    }
@@ -1253,7 +1872,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          chParams->rsp2TunerParams.biasTEnable = biasTen;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp2_BiasTControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_Rsp2_BiasTControl, sdrplay_api_Update_Ext1_None);
          }
       }
       if (device.hwVer == SDRPLAY_RSPduo_ID)
@@ -1261,7 +1880,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          chParams->rspDuoTunerParams.biasTEnable = biasTen;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_RspDuo_BiasTControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_RspDuo_BiasTControl, sdrplay_api_Update_Ext1_None);
          }
       }
       if (device.hwVer == SDRPLAY_RSP1A_ID)
@@ -1269,7 +1888,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          chParams->rsp1aTunerParams.biasTEnable = biasTen;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp1a_BiasTControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_Rsp1a_BiasTControl, sdrplay_api_Update_Ext1_None);
          }
       }
    }
@@ -1283,7 +1902,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          chParams->rsp2TunerParams.rfNotchEnable = notchEn;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp2_RfNotchControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_Rsp2_RfNotchControl, sdrplay_api_Update_Ext1_None);
          }
       }
       if (device.hwVer == SDRPLAY_RSPduo_ID)
@@ -1293,7 +1912,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
           chParams->rspDuoTunerParams.tuner1AmNotchEnable = notchEn;
           if (streamActive)
           {
-             sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_RspDuo_Tuner1AmNotchControl, sdrplay_api_Update_Ext1_None);
+             updateDevice(sdrplay_api_Update_RspDuo_Tuner1AmNotchControl, sdrplay_api_Update_Ext1_None);
           }
         }
         if (chParams->rspDuoTunerParams.tuner1AmPortSel == sdrplay_api_RspDuo_AMPORT_2)
@@ -1301,7 +1920,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
           chParams->rspDuoTunerParams.rfNotchEnable = notchEn;
           if (streamActive)
           {
-             sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_RspDuo_RfNotchControl, sdrplay_api_Update_Ext1_None);
+             updateDevice(sdrplay_api_Update_RspDuo_RfNotchControl, sdrplay_api_Update_Ext1_None);
           }
         }
       }
@@ -1310,7 +1929,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          deviceParams->devParams->rsp1aParams.rfNotchEnable = notchEn;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp1a_RfNotchControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_Rsp1a_RfNotchControl, sdrplay_api_Update_Ext1_None);
          }
       }
    }
@@ -1324,7 +1943,7 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          chParams->rspDuoTunerParams.rfDabNotchEnable = dabNotchEn;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_RspDuo_RfDabNotchControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_RspDuo_RfDabNotchControl, sdrplay_api_Update_Ext1_None);
          }
       }
       if (device.hwVer == SDRPLAY_RSP1A_ID)
@@ -1332,139 +1951,976 @@ void SoapySDRPlay3::writeSetting(const std::string &key, const std::string &valu
          deviceParams->devParams->rsp1aParams.rfDabNotchEnable = dabNotchEn;
          if (streamActive)
          {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Rsp1a_RfDabNotchControl, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_Rsp1a_RfDabNotchControl, sdrplay_api_Update_Ext1_None);
          }
       }
    }
-}
-
-void SoapySDRPlay3::changeRspDuoMode(const std::string &rspDuoModeString)
-{
-    sdrplay_api_TunerSelectT tuner = rspDuoModeStringToTuner(rspDuoModeString);
-    sdrplay_api_RspDuoModeT rspDuoMode = rspDuoModeStringToRspDuoMode(rspDuoModeString);
-    if ((rspDuoMode & sdrplay_api_RspDuoMode_Master) && (device.rspDuoMode & sdrplay_api_RspDuoMode_Master))
-    {
-        rspDuoMode = sdrplay_api_RspDuoMode_Master;
-    }
-    else if ((rspDuoMode & sdrplay_api_RspDuoMode_Slave) && (device.rspDuoMode & sdrplay_api_RspDuoMode_Slave))
-    {
-        rspDuoMode = sdrplay_api_RspDuoMode_Slave;
-    }
-    // if master device is available, select device as master
-    else if (rspDuoMode & sdrplay_api_RspDuoMode_Master)
-    {
-        rspDuoMode = sdrplay_api_RspDuoMode_Master;
-    }
-    if (rspDuoMode == device.rspDuoMode && tuner != device.tuner)
-    {
-        device.tuner = tuner;
-        sdrplay_api_SwapRspDuoActiveTuner(device.dev, &device.tuner, chParams->rspDuoTunerParams.tuner1AmPortSel);
-    }
-    else if (rspDuoMode != device.rspDuoMode)
-    {
-        sdrplay_api_ErrT err;
-
-        SoapySDR_logf(SOAPY_SDR_INFO, "Changed RSPduo mode - going to run ReleaseDevice+SelectDevice");
-        if (streamActive)
-        {
-            sdrplay_api_Uninit(device.dev);
-        }
-        streamActive = false;
-        sdrplay_api_ReleaseDevice(&device);
-        _bufA = 0;
-        _bufB = 0;
-        err = sdrplay_api_SelectDevice(&device);
-        if (err != sdrplay_api_Success)
-        {
-            SoapySDR_logf(SOAPY_SDR_ERROR, "SelectDevice Error: %s", sdrplay_api_GetErrorString(err));
-            throw std::runtime_error("SelectDevice() failed");
-        }
-    }
-}
-
-std::string SoapySDRPlay3::readSetting(const std::string &key) const
-{
-    std::lock_guard <std::mutex> lock(_general_state_mutex);
-
-    if (device.hwVer == SDRPLAY_RSPduo_ID && key == "rspduo_mode")
-    {
-       return rspDuoModetoString(device.tuner, device.rspDuoMode);
-    }
-
-#ifdef RF_GAIN_IN_MENU
-    if (key == "rfgain_sel")
-    {
-       if      (chParams->tunerParams.gain.LNAstate == 0) return "0";
-       else if (chParams->tunerParams.gain.LNAstate == 1) return "1";
-       else if (chParams->tunerParams.gain.LNAstate == 2) return "2";
-       else if (chParams->tunerParams.gain.LNAstate == 3) return "3";
-       else if (chParams->tunerParams.gain.LNAstate == 4) return "4";
-       else if (chParams->tunerParams.gain.LNAstate == 5) return "5";
-       else if (chParams->tunerParams.gain.LNAstate == 6) return "6";
-       else if (chParams->tunerParams.gain.LNAstate == 7) return "7";
-       else if (chParams->tunerParams.gain.LNAstate == 8) return "8";
-       else                                               return "9";
+   else if (key == "history_seconds")
+   {
+      historySeconds = std::max(0.0, stod(value));
+      resizeHistory();
+   }
+   else if (key == "snapshot_file")
+   {
+      std::lock_guard <std::mutex> stringsLock(_strings_mutex);
+      snapshotFile = value;
+   }
+   else if (key == "record_file")
+   {
+      startRecording(value);
+   }
+   else if (key == "metrics_format")
+   {
+      metricsFormat = (value == "json") ? "json" : "prometheus";
+      startMetricsWriter();
+   }
+   else if (key == "metrics_file")
+   {
+      {
+         std::lock_guard <std::mutex> stringsLock(_strings_mutex);
+         metricsFile = value;
+      }
+      startMetricsWriter();
+   }
+   else if (key == "metrics_interval")
+   {
+      metricsInterval = stod(value);
+      startMetricsWriter();
+   }
+   else if (key == "latency_histogram" && value == "reset")
+   {
+      _stateA.latency.reset();
+      _stateB.latency.reset();
+   }
+   else if (key == "sweep_range" || key == "sweep_fft_size" || key == "sweep_averages" || key == "sweep_overlap")
+   {
+      std::lock_guard <std::mutex> sweepLock(_sweep_mutex);
+      if (sweepRunning)
+      {
+         SoapySDR_logf(SOAPY_SDR_ERROR, "%s: cannot be changed while sweeping", key.c_str());
+      }
+      else if (key == "sweep_range")
+      {
+         // '<start>,<stop>' in Hz
+         double start, stop;
+         if (sscanf(value.c_str(), "%lf,%lf", &start, &stop) == 2 && stop > start)
+         {
+            sweepStart = start;
+            sweepStop = stop;
+         }
+         else
+         {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "sweep_range: invalid range '%s'", value.c_str());
+         }
+      }
+      else if (key == "sweep_fft_size")
+      {
+         unsigned int n = (unsigned int)std::strtoul(value.c_str(), 0, 10);
+         if (n >= 64 && n <= 65536 && (n & (n - 1)) == 0)
+         {
+            sweepFftSize = n;
+         }
+         else
+         {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "sweep_fft_size: %s is not a power of two between 64 and 65536", value.c_str());
+         }
+      }
+      else if (key == "sweep_averages")
+      {
+         unsigned long n = std::strtoul(value.c_str(), 0, 10);
+         if (n >= 1 && n <= MAX_SWEEP_AVERAGES)
+         {
+            sweepAverages = (unsigned int)n;
+         }
+         else
+         {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "sweep_averages: %s is not between 1 and %d", value.c_str(), MAX_SWEEP_AVERAGES);
+         }
+      }
+      else
+      {
+         sweepOverlap = std::min(std::max(stod(value), 0.0), 0.4);
+      }
+   }
+   else if (key == "standby_mode")
+   {
+      standbyMode = (value == "true");
+      if (!standbyMode && streamGated && streamActive)
+      {
+         // leaving standby while deactivated: stop the device for real
+         sdrplay_api_Uninit(device.dev);
+         streamActive = false;
+         streamGated = false;
+      }
+   }
+   else if (key == "txn")
+   {
+      // changes made between begin and commit are applied to the device
+      // with a single sdrplay_api_Update; the transaction belongs to the
+      // thread that began it
+      if (txnOpen && txnThread.load() != std::this_thread::get_id())
+      {
+         SoapySDR_logf(SOAPY_SDR_ERROR, "txn: cannot %s, the transaction is open in another thread", value.c_str());
+      }
+      else if (value == "begin")
+      {
+         if (txnOpen)
+         {
+            SoapySDR_log(SOAPY_SDR_WARNING, "txn: a transaction is already open");
+         }
+         txnThread = std::this_thread::get_id();
+         txnOpen = true;
+      }
+      else if (value == "commit")
+      {
+         if (!txnOpen)
+         {
+            SoapySDR_log(SOAPY_SDR_WARNING, "txn: no transaction is open");
+         }
+         txnOpen = false;
+         txnThread = std::thread::id();
+         sdrplay_api_ReasonForUpdateT reason = txnReason;
+         sdrplay_api_ReasonForUpdateExtension1T reasonExt1 = txnReasonExt1;
+         txnReason = sdrplay_api_Update_None;
+         txnReasonExt1 = sdrplay_api_Update_Ext1_None;
+         if (streamActive && (reason != sdrplay_api_Update_None || reasonExt1 != sdrplay_api_Update_Ext1_None))
+         {
+            updateDevice(reason, reasonExt1);
+            txnCommits++;
+         }
+      }
+      else if (value == "abort")
+      {
+         // the changes stay in the parameters and reach the device with
+         // the next update that covers them
+         txnOpen = false;
+         txnThread = std::thread::id();
+         txnReason = sdrplay_api_Update_None;
+         txnReasonExt1 = sdrplay_api_Update_Ext1_None;
+      }
+   }
+   else if (key == "callback_cadence" && value == "reset")
+   {
+      for (TunerState *state : { &_stateA, &_stateB })
+      {
+         state->callbackInterval.reset();
+         state->callbackSamples.reset();
+         state->stalls = 0;
+      }
+   }
+
+    publishSnapshot();
+}
+
+void SoapySDRPlay3::resizeHistory(void)
+{
+    size_t numSamples = (size_t)(historySeconds * reqSampleRate);
+    _histA.resize(numSamples);
+    if (device.hwVer == SDRPLAY_RSPduo_ID && device.rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner)
+    {
+        _histB.resize(numSamples);
+    }
+    else
+    {
+        _histB.resize(0);
+    }
+}
+
+void SoapySDRPlay3::writeSnapshot(const std::string &range)
+{
+    unsigned long long first;
+    unsigned long long last;
+    unsigned int channel = 0;
+    if (sscanf(range.c_str(), "%llu,%llu,%u", &first, &last, &channel) < 2 || last < first)
+    {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Invalid snapshot range '%s'", range.c_str());
+        return;
+    }
+
+    std::string path;
+    {
+        std::lock_guard <std::mutex> lock(_strings_mutex);
+        path = snapshotFile;
+    }
+
+    // copy the samples out first, a chunk at a time under the history
+    // ring lock only, so that the file I/O locks nothing
+    std::vector<short> samples;
+    unsigned long long written = 0;
+    {
+        // only what the history holds is allocated
+        unsigned long long histFirst, histLast;
+        const History &hist = (channel == 1) ? _histB : _histA;
+        if (hist.getRange(histFirst, histLast) && histLast > histFirst)
+        {
+            unsigned long long copyFirst = std::max(first, histFirst);
+            unsigned long long copyLast = std::min(last, histLast);
+            unsigned long long sampleNum = copyFirst;
+            samples.resize((size_t)(copyLast > copyFirst ? copyLast - copyFirst : 0) * elementsPerSample);
+            while (sampleNum < copyLast)
+            {
+                unsigned long long chunkFirst = sampleNum;
+                size_t n = readHistory(channel, chunkFirst, (size_t)(copyLast - sampleNum), samples.data() + written * elementsPerSample);
+                if (n == 0)
+                {
+                    break;
+                }
+                written += n;
+                sampleNum = chunkFirst + n;
+            }
+        }
+    }
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Can't open snapshot file '%s'", path.c_str());
+        return;
+    }
+    out.write((const char *)samples.data(), written * elementsPerSample * sizeof(short));
+
+    if (written != last - first)
+    {
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Snapshot %llu-%llu: only %llu samples available in history", first, last, written);
+    }
+}
+
+void SoapySDRPlay3::changeRspDuoMode(const std::string &rspDuoModeString)
+{
+    sdrplay_api_TunerSelectT tuner = rspDuoModeStringToTuner(rspDuoModeString);
+    sdrplay_api_RspDuoModeT rspDuoMode = rspDuoModeStringToRspDuoMode(rspDuoModeString);
+    if ((rspDuoMode & sdrplay_api_RspDuoMode_Master) && (device.rspDuoMode & sdrplay_api_RspDuoMode_Master))
+    {
+        rspDuoMode = sdrplay_api_RspDuoMode_Master;
+    }
+    else if ((rspDuoMode & sdrplay_api_RspDuoMode_Slave) && (device.rspDuoMode & sdrplay_api_RspDuoMode_Slave))
+    {
+        rspDuoMode = sdrplay_api_RspDuoMode_Slave;
+    }
+    // if master device is available, select device as master
+    else if (rspDuoMode & sdrplay_api_RspDuoMode_Master)
+    {
+        rspDuoMode = sdrplay_api_RspDuoMode_Master;
+    }
+    if (rspDuoMode == device.rspDuoMode && tuner != device.tuner)
+    {
+        device.tuner = tuner;
+        sdrplay_api_SwapRspDuoActiveTuner(device.dev, &device.tuner, chParams->rspDuoTunerParams.tuner1AmPortSel);
+    }
+    else if (rspDuoMode != device.rspDuoMode)
+    {
+        sdrplay_api_ErrT err;
+
+        // the stream buffers are shared with the reader, so the number
+        // of channels of a stream can't change under it
+        int newChannels = (rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner) ? 2 : 1;
+        if (streamSetup && newChannels != nchannels)
+        {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "rspduo_mode: close the stream before changing to '%s', it has %d channel(s)", rspDuoModeString.c_str(), nchannels);
+            return;
+        }
+
+        // the new mode needs ReleaseDevice+SelectDevice, which resets the
+        // parameters: keep a copy of them and of the streaming state, so
+        // that the switch is transparent to the application
+        SoapySDR_logf(SOAPY_SDR_INFO, "Changed RSPduo mode - going to run ReleaseDevice+SelectDevice");
+        auto startTime = std::chrono::steady_clock::now();
+        bool hasDevParams = deviceParams->devParams != 0;
+        sdrplay_api_DevParamsT savedDevParams;
+        if (hasDevParams)
+        {
+            savedDevParams = *deviceParams->devParams;
+        }
+        sdrplay_api_RxChannelParamsT savedChParams = *chParams;
+        sdrplay_api_TunerSelectT savedTuner = device.tuner;
+        sdrplay_api_RspDuoModeT savedRspDuoMode = device.rspDuoMode;
+        bool wasActive = streamActive;
+        bool wasGated = streamGated;
+
+        if (streamActive)
+        {
+            sdrplay_api_Uninit(device.dev);
+        }
+        streamActive = false;
+        streamGated = false;
+        auto uninitTime = std::chrono::steady_clock::now();
+
+        // selects the device in the given mode and reapplies the
+        // parameters; in dual tuner mode both tuners start from the
+        // settings of the tuner in use before the switch
+        auto selectMode = [&](sdrplay_api_TunerSelectT selTuner, sdrplay_api_RspDuoModeT selMode) -> const char *
+        {
+            device.tuner = selTuner;
+            device.rspDuoMode = selMode;
+            err = sdrplay_api_SelectDevice(&device);
+            if (err != sdrplay_api_Success)
+            {
+                return "SelectDevice";
+            }
+            err = sdrplay_api_GetDeviceParams(device.dev, &deviceParams);
+            if (err != sdrplay_api_Success)
+            {
+                sdrplay_api_ReleaseDevice(&device);
+                return "GetDeviceParams";
+            }
+            if (hasDevParams && deviceParams->devParams)
+            {
+                *deviceParams->devParams = savedDevParams;
+            }
+            chParams = device.tuner == sdrplay_api_Tuner_B ? deviceParams->rxChannelB : deviceParams->rxChannelA;
+            *chParams = savedChParams;
+            if (selMode == sdrplay_api_RspDuoMode_Dual_Tuner && deviceParams->rxChannelB)
+            {
+                *deviceParams->rxChannelB = savedChParams;
+            }
+            return 0;
+        };
+
+        sdrplay_api_ReleaseDevice(&device);
+        const char *failed = selectMode(tuner, rspDuoMode);
+        if (failed)
+        {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "%s Error: %s", failed, sdrplay_api_GetErrorString(err));
+            // go back to the previous mode, so that the device and the
+            // stream stay usable
+            if (selectMode(savedTuner, savedRspDuoMode))
+            {
+                removeSelectedDevice(&device);
+                SoapySDR_logf(SOAPY_SDR_ERROR, "rspduo_mode: could not go back to the previous mode: %s", sdrplay_api_GetErrorString(err));
+                throw std::runtime_error(std::string(failed) + "() failed");
+            }
+            if (wasActive)
+            {
+                err = initStream();
+                if (err != sdrplay_api_Success)
+                {
+                    SoapySDR_logf(SOAPY_SDR_ERROR, "Init Error: %s", sdrplay_api_GetErrorString(err));
+                    throw std::runtime_error("Init() failed");
+                }
+                streamActive = true;
+                streamGated = wasGated;
+            }
+            throw std::runtime_error(std::string(failed) + "() failed");
+        }
+        auto selectTime = std::chrono::steady_clock::now();
+
+        // empty the stream buffers in place, as activateStream() does; the
+        // sample count carries on, so the stream time stays monotonic
+        if (streamSetup)
+        {
+            for (Buffer *buf : {_bufA, _bufB})
+            {
+                if (!buf) continue;
+                std::lock_guard<std::mutex> bufLock(buf->mutex);
+                buf->nElems = 0;
+                buf->reset = true;
+            }
+        }
+        if (historySeconds > 0)
+        {
+            resizeHistory();
+        }
+
+        if (wasActive)
+        {
+            err = initStream();
+            if (err != sdrplay_api_Success)
+            {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "Init Error: %s", sdrplay_api_GetErrorString(err));
+                throw std::runtime_error("Init() failed");
+            }
+            streamActive = true;
+            streamGated = wasGated;
+        }
+        auto initTime = std::chrono::steady_clock::now();
+
+        char timing[256];
+        snprintf(timing, sizeof(timing), "uninit_ms=%.3f,select_ms=%.3f,init_ms=%.3f,total_ms=%.3f",
+                 std::chrono::duration<double, std::milli>(uninitTime - startTime).count(),
+                 std::chrono::duration<double, std::milli>(selectTime - uninitTime).count(),
+                 std::chrono::duration<double, std::milli>(initTime - selectTime).count(),
+                 std::chrono::duration<double, std::milli>(initTime - startTime).count());
+        {
+            std::lock_guard <std::mutex> stringsLock(_strings_mutex);
+            rspDuoSwitchTiming = timing;
+        }
+        SoapySDR_logf(SOAPY_SDR_INFO, "RSPduo mode switch timing: %s", timing);
+    }
+}
+
+std::string SoapySDRPlay3::readSetting(const std::string &key) const
+{
+    // the tunable state and the statistics are read without taking
+    // _general_state_mutex, so polling never waits for a retune
+    StateSnapshot snap = readSnapshot();
+
+    if (device.hwVer == SDRPLAY_RSPduo_ID && key == "rspduo_mode")
+    {
+       return rspDuoModetoString(snap.tuner, snap.rspDuoMode);
+    }
+
+#ifdef RF_GAIN_IN_MENU
+    if (key == "rfgain_sel")
+    {
+       return (snap.lnaState <= 8) ? std::to_string(snap.lnaState) : "9";
     }
     else
 #endif
     if (key == "if_mode")
     {
-        return IFtoString(chParams->tunerParams.ifType);
+        return IFtoString(snap.ifType);
     }
     else if (key == "iqcorr_ctrl")
     {
-       if (chParams->ctrlParams.dcOffset.IQenable == 0) return "false";
-       else                                             return "true";
+       return snap.iqCorr ? "true" : "false";
     }
     else if (key == "agc_setpoint")
     {
-       return std::to_string(chParams->ctrlParams.agc.setPoint_dBfs);
+       return std::to_string(snap.agcSetPoint);
     }
     else if (key == "extref_ctrl")
     {
-       unsigned char extRef = 0;
-       if (device.hwVer == SDRPLAY_RSP2_ID) extRef = deviceParams->devParams->rsp2Params.extRefOutputEn;
-      if (device.hwVer == SDRPLAY_RSPduo_ID) extRef = deviceParams->devParams->rspDuoParams.extRefOutputEn;
-       if (extRef == 0) return "false";
-       else             return "true";
+       return snap.extRef ? "true" : "false";
     }
     else if (key == "biasT_ctrl")
     {
-       unsigned char biasTen = 0;
-       if (device.hwVer == SDRPLAY_RSP2_ID) biasTen = chParams->rsp2TunerParams.biasTEnable;
-       if (device.hwVer == SDRPLAY_RSPduo_ID) biasTen = chParams->rspDuoTunerParams.biasTEnable;
-       if (device.hwVer == SDRPLAY_RSP1A_ID) biasTen = chParams->rsp1aTunerParams.biasTEnable;
-       if (biasTen == 0) return "false";
-       else              return "true";
+       return snap.biasT ? "true" : "false";
     }
     else if (key == "rfnotch_ctrl")
     {
-       unsigned char notchEn = 0;
-       if (device.hwVer == SDRPLAY_RSP2_ID) notchEn = chParams->rsp2TunerParams.rfNotchEnable;
-       if (device.hwVer == SDRPLAY_RSPduo_ID)
+       return snap.rfNotch ? "true" : "false";
+    }
+    else if (key == "dabnotch_ctrl")
+    {
+       return snap.dabNotch ? "true" : "false";
+    }
+    else if (key == "history_seconds")
+    {
+       return std::to_string(snap.historySeconds);
+    }
+    else if (key == "snapshot_file")
+    {
+       std::lock_guard <std::mutex> lock(_strings_mutex);
+       return snapshotFile;
+    }
+    else if (key == "history_range")
+    {
+       // available hardware sample numbers '<first>,<last>' on channel 0
+       unsigned long long first, last;
+       if (!_histA.getRange(first, last)) return "";
+       return std::to_string(first) + "," + std::to_string(last);
+    }
+    else if (key == "record_file")
+    {
+       std::lock_guard <std::mutex> lock(_strings_mutex);
+       return recordFile;
+    }
+    else if (key == "profile_load")
+    {
+       std::lock_guard <std::mutex> lock(_strings_mutex);
+       return profileFile;
+    }
+    else if (key == "rate_plan")
+    {
+       // the ADC rate is also the rate of the samples over USB
+       return "fs=" + std::to_string((unsigned long long)snap.fsHz) +
+              ",decimation=" + std::to_string(snap.decimation) +
+              ",rate=" + std::to_string(reqSampleRate.load()) +
+              ",bandwidth=" + std::to_string((unsigned long long)snap.bandwidth);
+    }
+    else if (key == "metrics")
+    {
+       return formatMetrics(snap.metricsJson ? "json" : "prometheus");
+    }
+    else if (key == "metrics_format")
+    {
+       return snap.metricsJson ? "json" : "prometheus";
+    }
+    else if (key == "metrics_file")
+    {
+       std::lock_guard <std::mutex> lock(_strings_mutex);
+       return metricsFile;
+    }
+    else if (key == "metrics_interval")
+    {
+       return std::to_string(snap.metricsInterval);
+    }
+    else if (key == "latency_histogram")
+    {
+       // buffer queueing latency in microseconds, one entry per channel
+       std::string hist = _stateA.latency.toString(1e3, "us");
+       if (nchannels > 1) hist += ";" + _stateB.latency.toString(1e3, "us");
+       return hist;
+    }
+    else if (key == "txn")
+    {
+       return txnOpen ? "begin" : "commit";
+    }
+    else if (key == "async_control")
+    {
+       return asyncControl ? "true" : "false";
+    }
+    else if (key == "standby_mode")
+    {
+       return standbyMode ? "true" : "false";
+    }
+    else if (key == "hop_list")
+    {
+       std::lock_guard <std::mutex> hopLock(_hop_mutex);
+       std::string list;
+       for (size_t i = 0; i < hopList.size(); i++)
        {
-          if (device.tuner == sdrplay_api_Tuner_A && chParams->rspDuoTunerParams.tuner1AmPortSel == sdrplay_api_RspDuo_AMPORT_1)
+          if (i > 0) list += ",";
+          list += std::to_string((long long)hopList[i]);
+       }
+       return list;
+    }
+    else if (key == "hop_dwell")
+    {
+       std::lock_guard <std::mutex> hopLock(_hop_mutex);
+       if (hopDwellSamples > 0) return std::to_string(hopDwellSamples);
+       return std::to_string(hopDwellSeconds * 1000.0) + "ms";
+    }
+    else if (key == "hop_frequency")
+    {
+       // frequency of the buffer last handed out on channel 0
+       if (!hopping || !_bufA) return "";
+       std::lock_guard <std::mutex> bufLock(_bufA->mutex);
+       return std::to_string((long long)_bufA->currentFrequency);
+    }
+    else if (key == "sweep")
+    {
+       return sweeping ? "start" : "stop";
+    }
+    else if (key == "sweep_range" || key == "sweep_fft_size" || key == "sweep_averages" || key == "sweep_overlap")
+    {
+       std::lock_guard <std::mutex> sweepLock(_sweep_mutex);
+       if (key == "sweep_range") return std::to_string((long long)sweepStart) + "," + std::to_string((long long)sweepStop);
+       if (key == "sweep_fft_size") return std::to_string(sweepFftSize);
+       if (key == "sweep_averages") return std::to_string(sweepAverages);
+       return std::to_string(sweepOverlap);
+    }
+    else if (key == "sweep_spectrum")
+    {
+       // '<start Hz>,<bin Hz>,<dBFS>,<dBFS>,...' of the last complete sweep
+       std::lock_guard <std::mutex> sweepLock(_sweep_mutex);
+       if (sweepSpectrum.empty()) return "";
+       std::string spectrum = std::to_string(sweepSpectrumStart) + "," + std::to_string(sweepSpectrumBinHz);
+       char str[32];
+       for (float p : sweepSpectrum)
+       {
+          snprintf(str, sizeof(str), ",%.1f", p);
+          spectrum += str;
+       }
+       return spectrum;
+    }
+    else if (key == "sweep_stats")
+    {
+       std::lock_guard <std::mutex> sweepLock(_sweep_mutex);
+       return "sweeps=" + std::to_string(sweepsCompleted.load()) +
+              ",step=" + std::to_string(sweepStep) + "/" + std::to_string(sweepSteps) +
+              ",settle_timeouts=" + std::to_string(sweepSettleTimeouts.load());
+    }
+    else if (key == "hop_stats")
+    {
+       return "hops=" + std::to_string(hops.load()) +
+              ",settle_timeouts=" + std::to_string(hopSettleTimeouts.load()) +
+              ",samples_discarded=" + std::to_string(hopSamplesDiscarded.load());
+    }
+    else if (key == "timed_commands")
+    {
+       size_t queued;
+       size_t awaiting;
+       {
+          std::lock_guard <std::mutex> ctrlLock(_ctrl_mutex);
+          queued = timedQueue.size();
+       }
+       {
+          std::lock_guard <std::mutex> awaitLock(_timed_await_mutex);
+          awaiting = timedAwait.size();
+       }
+       return "queued=" + std::to_string(timedQueued.load()) +
+              ",waiting=" + std::to_string(queued) +
+              ",issued=" + std::to_string(timedIssued.load()) +
+              ",awaiting=" + std::to_string(awaiting) +
+              ",landed=" + std::to_string(timedLanded.load()) +
+              ",last_landed_ns=" + std::to_string(timedLastLandedNs.load()) +
+              ",last_landed_sample=" + std::to_string(timedLastLandedSample.load()) +
+              "," + timedError.toString(1e3, "us");
+    }
+    else if (key == "startup_timing")
+    {
+       return startupTiming;
+    }
+    else if (key == "rspduo_switch_timing")
+    {
+       std::lock_guard <std::mutex> lock(_strings_mutex);
+       return rspDuoSwitchTiming;
+    }
+    else if (key == "update_latency")
+    {
+       // duration of the sdrplay_api_Update calls in microseconds
+       return updateLatency.toString(1e3, "us");
+    }
+    else if (key == "callback_cadence")
+    {
+       // per tuner callback interval in microseconds, samples per callback
+       // and the number of stalls, one entry per channel
+       std::string cadence;
+       const TunerState *states[] = { &_stateA, &_stateB };
+       for (int i = 0; i < nchannels; i++)
+       {
+          if (i > 0) cadence += ";";
+          cadence += "interval:" + states[i]->callbackInterval.toString(1e3, "us");
+          cadence += ";samples:" + states[i]->callbackSamples.toString(1.0, "n");
+          cadence += ";stalls=" + std::to_string(states[i]->stalls.load());
+       }
+       return cadence;
+    }
+    else if (key == "buffer_stats" || key == "average_stats")
+    {
+       // one entry per channel, separated by ';'
+       std::string stats;
+       Buffer *bufs[] = { _bufA, _bufB };
+       for (int ch = 0; ch < nchannels && bufs[ch]; ch++)
+       {
+          if (ch > 0) stats += ";";
+          if (key == "buffer_stats")
           {
-             notchEn = chParams->rspDuoTunerParams.tuner1AmNotchEnable;
+             std::lock_guard <std::mutex> bufLock(bufs[ch]->mutex);
+             stats += statsToString(bufs[ch]->currentStats);
           }
-          if (chParams->rspDuoTunerParams.tuner1AmPortSel == sdrplay_api_RspDuo_AMPORT_2)
+          else
           {
-             notchEn = chParams->rspDuoTunerParams.rfNotchEnable;
+             char str[256];
+             snprintf(str, sizeof(str), "power_dbfs=%.2f,peak_dbfs=%.2f,dc_i=%.6f,dc_q=%.6f,clip_rate=%.6f",
+                      bufs[ch]->avgPower.load(), bufs[ch]->avgPeak.load(),
+                      bufs[ch]->avgDcI.load(), bufs[ch]->avgDcQ.load(),
+                      bufs[ch]->avgClipped.load());
+             stats += str;
           }
        }
-       if (device.hwVer == SDRPLAY_RSP1A_ID) notchEn = deviceParams->devParams->rsp1aParams.rfNotchEnable;
-       if (notchEn == 0) return "false";
-       else              return "true";
+       return stats;
     }
-    else if (key == "dabnotch_ctrl")
+    else if (key == "record_stats")
     {
-       unsigned char dabNotchEn = 0;
-       if (device.hwVer == SDRPLAY_RSPduo_ID) dabNotchEn = chParams->rspDuoTunerParams.rfDabNotchEnable;
-       if (device.hwVer == SDRPLAY_RSP1A_ID) dabNotchEn = deviceParams->devParams->rsp1aParams.rfDabNotchEnable;
-       if (dabNotchEn == 0) return "false";
-       else                 return "true";
+       return "raw_bytes=" + std::to_string(_recA.rawBytes + _recB.rawBytes) +
+              ",encoded_bytes=" + std::to_string(_recA.encodedBytes + _recB.encodedBytes) +
+              ",dropped_blocks=" + std::to_string(_recA.droppedBlocks + _recB.droppedBlocks);
     }
 
     // SoapySDR_logf(SOAPY_SDR_WARNING, "Unknown setting '%s'", key.c_str());
     return "";
 }
+
+/*******************************************************************
+ * State snapshot
+ ******************************************************************/
+
+// called by the setters with _general_state_mutex held
+void SoapySDRPlay3::publishSnapshot(void)
+{
+    std::lock_guard <std::mutex> lock(_snapshot_mutex);
+
+    StateSnapshot &snap = _snapshotState;
+    snap.rfHz = (double)chParams->tunerParams.rfFreq.rfHz;
+    snap.ppm = deviceParams->devParams->ppm;
+    snap.ifGain = chParams->tunerParams.gain.gainVals.curr;
+    snap.bandwidth = getBwValueFromEnum(chParams->tunerParams.bwType);
+    snap.lnaState = chParams->tunerParams.gain.LNAstate;
+    snap.agcSetPoint = chParams->ctrlParams.agc.setPoint_dBfs;
+    snap.ifType = chParams->tunerParams.ifType;
+    snap.tuner = device.tuner;
+    snap.rspDuoMode = device.rspDuoMode;
+    snap.agcEnabled = (chParams->ctrlParams.agc.enable != sdrplay_api_AGC_DISABLE);
+    snap.dcOffset = (chParams->ctrlParams.dcOffset.DCenable != 0);
+    snap.iqCorr = (chParams->ctrlParams.dcOffset.IQenable != 0);
+    snap.metricsJson = (metricsFormat == "json");
+    snap.historySeconds = historySeconds;
+    snap.metricsInterval = metricsInterval;
+    snap.fsHz = deviceParams->devParams ? deviceParams->devParams->fsFreq.fsHz : 0;
+    snap.decimation = chParams->ctrlParams.decimation.enable ? chParams->ctrlParams.decimation.decimationFactor : 1;
+
+    if (device.hwVer == SDRPLAY_RSP2_ID)
+    {
+        if (chParams->rsp2TunerParams.amPortSel == sdrplay_api_Rsp2_AMPORT_1) {
+            snap.antenna = "Hi-Z";
+        }
+        else if (chParams->rsp2TunerParams.antennaSel == sdrplay_api_Rsp2_ANTENNA_A) {
+            snap.antenna = "Antenna A";
+        }
+        else {
+            snap.antenna = "Antenna B";
+        }
+    }
+    else if (device.hwVer == SDRPLAY_RSPduo_ID)
+    {
+        if (chParams->rspDuoTunerParams.tuner1AmPortSel == sdrplay_api_RspDuo_AMPORT_1) {
+            snap.antenna = "Tuner 1 Hi-Z";
+        }
+        else if (device.tuner == sdrplay_api_Tuner_A) {
+            snap.antenna = "Tuner 1 50 ohm";
+        }
+        else {
+            snap.antenna = "Tuner 2 50 ohm";
+        }
+    }
+    else
+    {
+        snap.antenna = "RX";
+    }
+
+    snap.extRef = false;
+    if (device.hwVer == SDRPLAY_RSP2_ID) snap.extRef = deviceParams->devParams->rsp2Params.extRefOutputEn != 0;
+    if (device.hwVer == SDRPLAY_RSPduo_ID) snap.extRef = deviceParams->devParams->rspDuoParams.extRefOutputEn != 0;
+
+    snap.biasT = false;
+    if (device.hwVer == SDRPLAY_RSP2_ID) snap.biasT = chParams->rsp2TunerParams.biasTEnable != 0;
+    if (device.hwVer == SDRPLAY_RSPduo_ID) snap.biasT = chParams->rspDuoTunerParams.biasTEnable != 0;
+    if (device.hwVer == SDRPLAY_RSP1A_ID) snap.biasT = chParams->rsp1aTunerParams.biasTEnable != 0;
+
+    snap.rfNotch = false;
+    if (device.hwVer == SDRPLAY_RSP2_ID) snap.rfNotch = chParams->rsp2TunerParams.rfNotchEnable != 0;
+    if (device.hwVer == SDRPLAY_RSPduo_ID)
+    {
+        if (device.tuner == sdrplay_api_Tuner_A && chParams->rspDuoTunerParams.tuner1AmPortSel == sdrplay_api_RspDuo_AMPORT_1)
+        {
+            snap.rfNotch = chParams->rspDuoTunerParams.tuner1AmNotchEnable != 0;
+        }
+        if (chParams->rspDuoTunerParams.tuner1AmPortSel == sdrplay_api_RspDuo_AMPORT_2)
+        {
+            snap.rfNotch = chParams->rspDuoTunerParams.rfNotchEnable != 0;
+        }
+    }
+    if (device.hwVer == SDRPLAY_RSP1A_ID) snap.rfNotch = deviceParams->devParams->rsp1aParams.rfNotchEnable != 0;
+
+    snap.dabNotch = false;
+    if (device.hwVer == SDRPLAY_RSPduo_ID) snap.dabNotch = chParams->rspDuoTunerParams.rfDabNotchEnable != 0;
+    if (device.hwVer == SDRPLAY_RSP1A_ID) snap.dabNotch = deviceParams->devParams->rsp1aParams.rfDabNotchEnable != 0;
+
+    storeSnapshot();
+}
+
+// called by the event callback, which does not hold _general_state_mutex
+void SoapySDRPlay3::publishGain(double ifGain)
+{
+    std::lock_guard <std::mutex> lock(_snapshot_mutex);
+
+    _snapshotState.ifGain = ifGain;
+    storeSnapshot();
+}
+
+// seqlock write side; the caller holds _snapshot_mutex
+void SoapySDRPlay3::storeSnapshot(void)
+{
+    const size_t numWords = sizeof(_snapshotWords) / sizeof(_snapshotWords[0]);
+    uint64_t words[numWords] = {};
+    std::memcpy(words, &_snapshotState, sizeof(StateSnapshot));
+
+    unsigned int seq = _snapshotSeq.load(std::memory_order_relaxed);
+    _snapshotSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < numWords; i++)
+    {
+        _snapshotWords[i].store(words[i], std::memory_order_relaxed);
+    }
+    _snapshotSeq.store(seq + 2, std::memory_order_release);
+}
+
+// seqlock read side; retries only while a writer is publishing
+SoapySDRPlay3::StateSnapshot SoapySDRPlay3::readSnapshot(void) const
+{
+    const size_t numWords = sizeof(_snapshotWords) / sizeof(_snapshotWords[0]);
+    uint64_t words[numWords];
+    unsigned int seq0, seq1;
+    do
+    {
+        seq0 = _snapshotSeq.load(std::memory_order_acquire);
+        for (size_t i = 0; i < numWords; i++)
+        {
+            words[i] = _snapshotWords[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq1 = _snapshotSeq.load(std::memory_order_relaxed);
+    } while ((seq0 & 1) || seq0 != seq1);
+
+    StateSnapshot snap;
+    std::memcpy(&snap, words, sizeof(StateSnapshot));
+    return snap;
+}
+
+/*******************************************************************
+ * Sensor API
+ ******************************************************************/
+
+// all the sensors read atomics updated by the callbacks; none of them
+// takes a lock, so they can be polled at any rate
+
+std::vector<std::string> SoapySDRPlay3::listSensors(void) const
+{
+    std::vector<std::string> sensors;
+    sensors.push_back("stream_active");
+    sensors.push_back("ctrl_pending");
+    sensors.push_back("ctrl_completed");
+    return sensors;
+}
+
+SoapySDR::ArgInfo SoapySDRPlay3::getSensorInfo(const std::string &key) const
+{
+    SoapySDR::ArgInfo info;
+    if (key == "stream_active")
+    {
+        info.key = "stream_active";
+        info.name = "Stream Active";
+        info.description = "Streaming from the device is active";
+        info.type = SoapySDR::ArgInfo::BOOL;
+    }
+    else if (key == "ctrl_pending")
+    {
+        info.key = "ctrl_pending";
+        info.name = "Control Pending";
+        info.description = "Asynchronous control requests not applied yet";
+        info.type = SoapySDR::ArgInfo::INT;
+    }
+    else if (key == "ctrl_completed")
+    {
+        info.key = "ctrl_completed";
+        info.name = "Control Completed";
+        info.description = "Asynchronous control requests applied so far (superseded ones included, hop and sweep retunes not counted)";
+        info.type = SoapySDR::ArgInfo::INT;
+    }
+    return info;
+}
+
+std::string SoapySDRPlay3::readSensor(const std::string &key) const
+{
+    if (key == "stream_active")
+    {
+        return (streamActive && !streamGated) ? "true" : "false";
+    }
+    else if (key == "ctrl_pending")
+    {
+        return std::to_string(ctrlPending.load());
+    }
+    else if (key == "ctrl_completed")
+    {
+        return std::to_string(ctrlCompleted.load());
+    }
+    return "";
+}
+
+std::vector<std::string> SoapySDRPlay3::listSensors(const int direction, const size_t channel) const
+{
+    std::vector<std::string> sensors;
+    if (direction != SOAPY_SDR_RX)
+    {
+        return sensors;
+    }
+    sensors.push_back("overload");
+    sensors.push_back("gain_db");
+    sensors.push_back("buffer_fill");
+    sensors.push_back("overflows");
+    sensors.push_back("power_dbfs");
+    sensors.push_back("peak_dbfs");
+    sensors.push_back("clip_rate");
+    return sensors;
+}
+
+SoapySDR::ArgInfo SoapySDRPlay3::getSensorInfo(const int direction, const size_t channel, const std::string &key) const
+{
+    SoapySDR::ArgInfo info;
+    info.key = key;
+    if (key == "overload")
+    {
+        info.name = "Overload";
+        info.description = "Power overload reported by the device";
+        info.type = SoapySDR::ArgInfo::BOOL;
+    }
+    else if (key == "gain_db")
+    {
+        info.name = "Gain";
+        info.description = "Calibrated gain reported by the device";
+        info.units = "dB";
+        info.type = SoapySDR::ArgInfo::FLOAT;
+    }
+    else if (key == "buffer_fill")
+    {
+        info.name = "Buffer Fill";
+        info.description = "Fraction of the stream buffers waiting to be read";
+        info.type = SoapySDR::ArgInfo::FLOAT;
+        info.range = SoapySDR::Range(0, 1);
+    }
+    else if (key == "overflows")
+    {
+        info.name = "Overflows";
+        info.description = "Number of stream buffer overflows";
+        info.type = SoapySDR::ArgInfo::INT;
+    }
+    else if (key == "power_dbfs")
+    {
+        info.name = "Power";
+        info.description = "Average signal power";
+        info.units = "dBFS";
+        info.type = SoapySDR::ArgInfo::FLOAT;
+    }
+    else if (key == "peak_dbfs")
+    {
+        info.name = "Peak";
+        info.description = "Peak signal power";
+        info.units = "dBFS";
+        info.type = SoapySDR::ArgInfo::FLOAT;
+    }
+    else if (key == "clip_rate")
+    {
+        info.name = "Clip Rate";
+        info.description = "Average fraction of samples near full scale";
+        info.type = SoapySDR::ArgInfo::FLOAT;
+        info.range = SoapySDR::Range(0, 1);
+    }
+    return info;
+}
+
+std::string SoapySDRPlay3::readSensor(const int direction, const size_t channel, const std::string &key) const
+{
+    if (direction != SOAPY_SDR_RX || channel > 1)
+    {
+        return "";
+    }
+    const TunerState &state = (channel == 1) ? _stateB : _stateA;
+    const Buffer *buf = (channel == 1) ? _bufB : _bufA;
+
+    if (key == "overload")
+    {
+        return state.overload ? "true" : "false";
+    }
+    else if (key == "gain_db")
+    {
+        return std::to_string(state.currGain.load());
+    }
+    else if (key == "overflows")
+    {
+        return std::to_string(state.overflows.load());
+    }
+
+    if (!buf)
+    {
+        return "";
+    }
+    if (key == "buffer_fill")
+    {
+        return std::to_string((double)buf->count.load() / numBuffers);
+    }
+    else if (key == "power_dbfs")
+    {
+        return std::to_string(buf->avgPower.load());
+    }
+    else if (key == "peak_dbfs")
+    {
+        return std::to_string(buf->avgPeak.load());
+    }
+    else if (key == "clip_rate")
+    {
+        return std::to_string(buf->avgClipped.load());
+    }
+    return "";
+}
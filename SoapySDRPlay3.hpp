@@ -35,13 +35,40 @@
 #include <condition_variable>
 #include <string>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <complex>
 #include <algorithm>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <fstream>
+#include <chrono>
 
 #include <sdrplay_api.h>
 
 #define DEFAULT_BUFFER_LENGTH     (65536)
 #define DEFAULT_NUM_BUFFERS       (8)
 #define DEFAULT_ELEMS_PER_SAMPLE  (2)
+#define DEFAULT_CLIP_LEVEL        (32000)
+#define DEFAULT_STATS_AVERAGING   (0.1f)
+#define HISTOGRAM_BUCKETS         (252)
+#define DEFAULT_STALL_FACTOR      (4.0)
+#define DEFAULT_HOP_SETTLE_TIMEOUT (0.1)
+#define DEFAULT_ENUM_CACHE_TTL    (2.0)
+#define DEFAULT_SWEEP_FFT_SIZE    (1024)
+#define DEFAULT_SWEEP_AVERAGES    (8)
+#define MAX_SWEEP_AVERAGES        (256)
+#define DEFAULT_SWEEP_OVERLAP     (0.1)
+
+// readStream() flags set on the first read of the samples following a
+// change reported by the stream callback; each read returns the samples
+// of one side of the change only
+#define SOAPY_SDRPLAY_GAIN_CHANGED      SOAPY_SDR_USER_FLAG0
+#define SOAPY_SDRPLAY_FREQUENCY_CHANGED SOAPY_SDR_USER_FLAG1
+#define SOAPY_SDRPLAY_RATE_CHANGED      SOAPY_SDR_USER_FLAG2
 
 class SoapySDRPlay3: public SoapySDR::Device
 {
@@ -100,6 +127,7 @@ public:
                    const long timeoutUs = 200000);
 
     class Buffer;
+    struct BufferStats;
     int readChannel(SoapySDR::Stream *stream,
                     void *buff,
                     const size_t numElems,
@@ -126,6 +154,30 @@ public:
 
     void releaseReadBuffer(SoapySDR::Stream *stream, const size_t handle);
 
+    /*******************************************************************
+     * History API
+     ******************************************************************/
+
+    size_t readHistory(const size_t channel,
+                       unsigned long long &firstSampleNum,
+                       const size_t numSamples,
+                       short *buff);
+
+    /*******************************************************************
+     * Recording API
+     ******************************************************************/
+
+    struct RecordingBlock
+    {
+        unsigned long long offset;
+        unsigned long long firstSampleNum;
+        unsigned int numSamples;
+    };
+
+    static bool readRecordingIndex(const std::string &path, std::vector<RecordingBlock> &index);
+
+    static bool readRecordingBlock(const std::string &path, const RecordingBlock &block, std::vector<short> &samples);
+
     /*******************************************************************
      * Antenna API
      ******************************************************************/
@@ -206,6 +258,18 @@ public:
     
     bool hasDCOffset(const int direction, const size_t channel) const;
 
+    /*******************************************************************
+     * Time API
+     ******************************************************************/
+
+    bool hasHardwareTime(const std::string &what = "") const;
+
+    long long getHardwareTime(const std::string &what = "") const;
+
+    void setHardwareTime(const long long timeNs, const std::string &what = "");
+
+    void setCommandTime(const long long timeNs, const std::string &what = "");
+
     /*******************************************************************
      * Settings API
      ******************************************************************/
@@ -218,11 +282,27 @@ public:
 
     std::string readSetting(const std::string &key) const;
 
+    /*******************************************************************
+     * Sensor API
+     ******************************************************************/
+
+    std::vector<std::string> listSensors(void) const;
+
+    SoapySDR::ArgInfo getSensorInfo(const std::string &key) const;
+
+    std::string readSensor(const std::string &key) const;
+
+    std::vector<std::string> listSensors(const int direction, const size_t channel) const;
+
+    SoapySDR::ArgInfo getSensorInfo(const int direction, const size_t channel, const std::string &key) const;
+
+    std::string readSensor(const int direction, const size_t channel, const std::string &key) const;
+
     /*******************************************************************
      * Async API
      ******************************************************************/
 
-    void rx_callback(short *xi, short *xq, unsigned int numSamples, sdrplay_api_TunerSelectT tuner);
+    void rx_callback(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, sdrplay_api_TunerSelectT tuner);
 
     void ev_callback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner, sdrplay_api_EventParamsT *params);
 
@@ -234,7 +314,7 @@ private:
 
     static double getRateForBwEnum(sdrplay_api_Bw_MHzT bwEnum);
 
-    static uint32_t getInputSampleRateAndDecimation(uint32_t rate, unsigned int *decM, unsigned int *decEnable, sdrplay_api_If_kHzT ifMode);
+    static uint32_t getInputSampleRateAndDecimation(uint32_t rate, unsigned int *decM, unsigned int *decEnable, sdrplay_api_If_kHzT ifMode, double bandwidth);
 
     static sdrplay_api_Bw_MHzT getBwEnumForRate(double rate, sdrplay_api_If_kHzT ifMode);
 
@@ -252,6 +332,160 @@ private:
 
     static std::string IFtoString(sdrplay_api_If_kHzT ifkHzT);
 
+    static std::string statsToString(const BufferStats &stats);
+
+    void publishBuffer(Buffer *buf);
+
+    void drainBuffer(Buffer *buf);
+
+    bool flushBuffer(Buffer *buf);
+
+    void releaseBuffer(Buffer *buf, const size_t handle);
+
+    sdrplay_api_ErrT initStream(void);
+
+    void updateAverageStats(Buffer *buf, const BufferStats &stats);
+
+    void resizeHistory(void);
+
+    void writeSnapshot(const std::string &range);
+
+    bool saveProfile(const std::string &path);
+
+    bool loadProfile(const std::string &path);
+
+    void startRecording(const std::string &path);
+
+    sdrplay_api_ErrT updateDevice(sdrplay_api_ReasonForUpdateT reasonForUpdate,
+                                  sdrplay_api_ReasonForUpdateExtension1T reasonForUpdateExt1);
+
+    std::string formatMetrics(const std::string &format) const;
+
+    void startMetricsWriter(void);
+
+    void stopMetricsWriter(void);
+
+    void runMetricsWriter(const std::string path, const std::string format, const double interval);
+
+    // copy of the tunable state for the getters; the setters publish it
+    // after every change and the getters read it without taking
+    // _general_state_mutex (seqlock)
+    struct StateSnapshot
+    {
+        double rfHz;
+        double ppm;
+        double ifGain;
+        double bandwidth;
+        int lnaState;
+        int agcSetPoint;
+        sdrplay_api_If_kHzT ifType;
+        sdrplay_api_TunerSelectT tuner;
+        sdrplay_api_RspDuoModeT rspDuoMode;
+        const char *antenna;
+        bool agcEnabled;
+        bool dcOffset;
+        bool iqCorr;
+        bool extRef;
+        bool biasT;
+        bool rfNotch;
+        bool dabNotch;
+        bool metricsJson;
+        double historySeconds;
+        double metricsInterval;
+        uint32_t fsHz;
+        unsigned int decimation;
+    };
+
+    sdrplay_api_ReasonForUpdateT applyFrequency(const std::string &name, const double frequency);
+
+    sdrplay_api_ReasonForUpdateT applyGain(const std::string &name, const double value);
+
+    // asynchronous control; the setters leave the latest value of each
+    // kind here and the control thread applies them
+    enum ControlKind
+    {
+        CONTROL_RF,
+        CONTROL_CORR,
+        CONTROL_IFGR,
+        CONTROL_RFGR,
+        CONTROL_KINDS
+    };
+
+    struct ControlSlot
+    {
+        bool pending;
+        bool engine;
+        double value;
+    };
+
+    void queueControl(ControlKind kind, double value, bool engine);
+
+    // timed control; commands set while a command time is in effect wait
+    // here (sorted by time) until the control thread issues them
+    struct TimedControl
+    {
+        long long timeNs;
+        ControlKind kind;
+        double value;
+    };
+
+    void queueTimedControl(ControlKind kind, double value, long long timeNs);
+
+    // an issued timed command waiting for the rx callback of tuner A to
+    // report the change it causes (SOAPY_SDRPLAY_GAIN_CHANGED or
+    // SOAPY_SDRPLAY_FREQUENCY_CHANGED); seq numbers its update among the
+    // updates that cause that change
+    struct TimedAwait
+    {
+        long long timeNs;
+        int change;
+        unsigned long long seq;
+    };
+
+    void timedLanding(int change, unsigned long long sampleNum);
+
+    void countChangeUpdate(sdrplay_api_ReasonForUpdateT reasonForUpdate);
+
+    void updateTimeBase(unsigned long long sampleNum, unsigned int numSamples);
+
+    long long sampleToTimeNs(unsigned long long sampleNum) const;
+
+    bool sampleToTimeNs(unsigned long long sampleNum, long long &timeNs) const;
+
+    bool timeToSteady(long long timeNs, std::chrono::steady_clock::time_point &when) const;
+
+    void startControlThread(void);
+
+    void stopControlThread(void);
+
+    void runControl(void);
+
+    bool hopCallback(const sdrplay_api_StreamCbParamsT *params, unsigned int numSamples);
+
+    void setHopList(const std::string &list);
+
+    void updateControlThread(void);
+
+    void sweepCallback(const short *xi, const short *xq, const sdrplay_api_StreamCbParamsT *params, unsigned int numSamples);
+
+    void startSweep(void);
+
+    void stopSweep(void);
+
+    void runSweep(void);
+
+    void beginSweep(void);
+
+    void tuneSweepStep(void);
+
+    void publishSnapshot(void);
+
+    void publishGain(double ifGain);
+
+    void storeSnapshot(void);
+
+    StateSnapshot readSnapshot(void) const;
+
     /*******************************************************************
      * Private variables
      ******************************************************************/
@@ -261,8 +495,10 @@ private:
     sdrplay_api_RxChannelParamsT *chParams;
     float ver;
 
-    //cached settings
-    uint32_t reqSampleRate;
+    //cached settings; the ones read by rx_callback are atomics, since
+    //the callback does not take _general_state_mutex
+    std::atomic<uint32_t> reqSampleRate;
+    std::atomic_uint decimationFactor;
     std::atomic_ulong bufferLength;
 
     //numBuffers, bufferElems, elementsPerSample
@@ -275,10 +511,149 @@ private:
  
     std::atomic_bool streamActive;
 
+    // between setupStream() and closeStream()
+    std::atomic_bool streamSetup;
+
+    // standby mode: deactivateStream() leaves the device streaming and
+    // only gates the delivery (streamGated)
+    std::atomic_bool standbyMode;
+    std::atomic_bool streamGated;
+
     std::atomic_bool useShort;
 
     int nchannels;
 
+    //the string settings; written with _general_state_mutex held as well,
+    //read by readSetting() under _strings_mutex alone
+    mutable std::mutex _strings_mutex;
+
+    //history (pre-trigger lookback) settings
+    double historySeconds;
+    std::string snapshotFile;
+
+    std::string recordFile;
+
+    //metrics
+    std::atomic_ullong updateCalls;
+    std::atomic_ullong updateErrors;
+    std::atomic_ullong updateTimeNs;
+    std::atomic_ullong updateMaxNs;
+    std::atomic_ullong txnCommits;
+    std::atomic_ullong txnStagedUpdates;
+    std::string metricsFormat;
+    std::string metricsFile;
+    double metricsInterval;
+    std::thread metricsThread;
+    std::mutex metricsMutex;
+    std::condition_variable metricsCond;
+    bool metricsRunning;
+
+    std::string startupTiming;
+
+    std::string rspDuoSwitchTiming;
+
+    std::string profileFile;
+
+    //settings transaction; while it is open updateDevice only collects
+    //the reasons for update of the thread that opened it and the commit
+    //issues them all at once
+    std::atomic_bool txnOpen;
+    std::atomic<std::thread::id> txnThread;
+    sdrplay_api_ReasonForUpdateT txnReason;
+    sdrplay_api_ReasonForUpdateExtension1T txnReasonExt1;
+
+    //asynchronous control
+    std::atomic_bool asyncControl;
+    std::thread ctrlThread;
+    mutable std::mutex _ctrl_mutex;
+    std::condition_variable ctrlCond;
+    bool ctrlRunning;
+    ControlSlot ctrlSlots[CONTROL_KINDS];
+    std::atomic_ullong ctrlRequests;
+    std::atomic_ullong ctrlSuperseded;
+    std::atomic_ullong ctrlCompleted;
+    std::atomic_ullong ctrlPending;
+
+    //timed control; the time base maps the 64 bit sample counter of tuner A
+    //to nanoseconds and is kept by the rx callback under _time_mutex
+    mutable std::mutex _time_mutex;
+    bool timeValid;
+    unsigned long long timeAnchorSample;
+    long long timeAnchorNs;
+    uint32_t timeAnchorRate;
+    unsigned long long timeNextSample;
+    std::chrono::steady_clock::time_point timeLastCallback;
+    std::atomic_llong commandTimeNs;
+    std::deque<TimedControl> timedQueue;
+    mutable std::mutex _timed_await_mutex;
+    std::deque<TimedAwait> timedAwait;
+    unsigned long long rfUpdatesIssued;
+    unsigned long long rfChangesReported;
+    unsigned long long grUpdatesIssued;
+    unsigned long long grChangesReported;
+    std::atomic_ullong timedQueued;
+    std::atomic_ullong timedIssued;
+    std::atomic_ullong timedLanded;
+    std::atomic_llong timedLastLandedNs;
+    std::atomic_ullong timedLastLandedSample;
+
+    //frequency hopping; hopList and the dwell are changed by writeSetting,
+    //the rest belongs to the rx callback thread; all under _hop_mutex
+    mutable std::mutex _hop_mutex;
+    std::atomic_bool hopping;
+    std::vector<double> hopList;
+    unsigned long long hopDwellSamples;
+    double hopDwellSeconds;
+    size_t hopIndex;
+    unsigned long long hopDwellCount;
+    bool hopSettling;
+    unsigned long long hopSettleCount;
+    std::atomic<double> hopFrequency;
+    std::atomic_ullong hops;
+    std::atomic_ullong hopSettleTimeouts;
+    std::atomic_ullong hopSamplesDiscarded;
+
+    //wideband sweep; the rx callback captures the samples of each step and
+    //the sweep thread computes and stitches the spectra; all under
+    //_sweep_mutex
+    enum SweepState
+    {
+        SWEEP_SETTLING,
+        SWEEP_CAPTURING,
+        SWEEP_PROCESSING
+    };
+    mutable std::mutex _sweep_mutex;
+    std::condition_variable sweepCond;
+    std::thread sweepThread;
+    std::atomic_bool sweeping;
+    bool sweepRunning;
+    double sweepStart;
+    double sweepStop;
+    unsigned int sweepFftSize;
+    unsigned int sweepAverages;
+    double sweepOverlap;
+    SweepState sweepState;
+    unsigned long long sweepSettleCount;
+    std::vector<std::complex<float> > sweepCapture;
+    size_t sweepCaptured;
+    size_t sweepStep;
+    size_t sweepSteps;
+    unsigned int sweepTrim;
+    double sweepBinHz;
+    double sweepTunedHz;
+    std::vector<float> sweepAccum;
+    std::vector<float> sweepSpectrum;
+    double sweepSpectrumStart;
+    double sweepSpectrumBinHz;
+    std::atomic_ullong sweepsCompleted;
+    std::atomic_ullong sweepSettleTimeouts;
+
+    //state snapshot; _snapshot_mutex serializes the writers only
+    std::mutex _snapshot_mutex;
+    StateSnapshot _snapshotState;
+    std::atomic_uint _snapshotSeq;
+    std::atomic<uint64_t> _snapshotWords[(sizeof(StateSnapshot) + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+
 public:
 
    /*******************************************************************
@@ -302,6 +677,18 @@ public:
     std::atomic_bool resetBuffer;
 #endif
 
+    // signal statistics of the samples in a buffer, accumulated by the
+    // rx callback while it converts them
+    struct BufferStats
+    {
+        unsigned long numSamples;
+        long long sumI;
+        long long sumQ;
+        unsigned long long sumPower;
+        unsigned int peakPower;
+        unsigned long clipped;
+    };
+
     class Buffer
     {
     public:
@@ -314,13 +701,172 @@ public:
         std::vector<std::vector<short> > buffs;
         size_t      head;
         size_t      tail;
-        size_t      count;
+        std::atomic_size_t count;
         short *currentBuff;
         bool overflowEvent;
         std::atomic_size_t nElems;
         size_t currentHandle;
         std::atomic_bool reset;
+
+        // per buffer statistics, plus those of the buffer last handed out
+        // to the reader and their exponential averages (in dBFS/full scale)
+        std::vector<BufferStats> stats;
+        std::vector<std::chrono::steady_clock::time_point> publishTime;
+        BufferStats currentStats;
+        // hop frequency of each buffer (0 when not hopping)
+        std::vector<double> frequency;
+        double currentFrequency;
+        // sample number of the first sample of each buffer, and of the
+        // next sample to be read from the buffer handed out to the reader
+        std::vector<unsigned long long> firstSample;
+        unsigned long long currentSample;
+        // SOAPY_SDRPLAY_*_CHANGED (and SOAPY_SDR_END_BURST) flags of each
+        // buffer; pendingChanges are set by the settings that do not get
+        // reported by the API
+        std::vector<int> changes;
+        std::atomic_int pendingChanges;
+        bool currentEndBurst;
+
+        // finite burst requested by activateStream(); the rx callback only
+        // delivers the samples from burstStartNs on, burstRemaining of them
+        bool burstActive;
+        bool burstWaitStart;
+        long long burstStartNs;
+        bool burstLimited;
+        unsigned long long burstRemaining;
+        bool burstDone;
+        std::atomic<float> avgPower;
+        std::atomic<float> avgPeak;
+        std::atomic<float> avgDcI;
+        std::atomic<float> avgDcQ;
+        std::atomic<float> avgClipped;
+        bool avgValid;
+
+        // hardware sample counter (firstSampleNum) extended to 64 bits;
+        // only accessed from the rx callback thread
+        unsigned long long nextSampleNum;
+        bool sampleNumValid;
     };
 
     Buffer *_bufA, *_bufB;
+
+    // log bucketed histogram (4 buckets per octave); the counters are
+    // atomics, so the stream threads can record without taking a lock
+    class Histogram
+    {
+    public:
+        Histogram(void);
+
+        void record(unsigned long long value);
+        void reset(void);
+        unsigned long long percentile(double p) const;
+        std::string toString(double scale, const char *units) const;
+
+        std::atomic_ullong buckets[HISTOGRAM_BUCKETS];
+        std::atomic_ullong count;
+        std::atomic_ullong sum;
+        std::atomic_ullong min;
+        std::atomic_ullong max;
+    };
+
+    // live per tuner state, updated from the callbacks and read lock free
+    // by the sensors
+    struct TunerState
+    {
+        TunerState(void);
+
+        std::atomic_bool overload;
+        std::atomic<double> currGain;
+        std::atomic_ullong overflows;
+
+        std::atomic_ullong callbacks;
+        std::atomic_ullong samplesReceived;
+        std::atomic_ullong samplesRead;
+        std::atomic_ullong samplesDroppedFull;
+        std::atomic_ullong samplesDroppedFlush;
+        std::atomic_ullong resets;
+        std::atomic_ullong timeouts;
+
+        // time from rx_callback completing a buffer to the reader getting it
+        Histogram latency;
+
+        // time between stream callbacks and samples per callback; a stall
+        // is an interval more than DEFAULT_STALL_FACTOR times the expected
+        // one for the current sample rate
+        Histogram callbackInterval;
+        Histogram callbackSamples;
+        std::atomic_ullong stalls;
+        std::atomic_llong lastCallbackNs;
+    };
+
+    TunerState _stateA, _stateB;
+
+    // duration of the sdrplay_api_Update calls
+    Histogram updateLatency;
+    // |landed - scheduled| of the timed commands
+    Histogram timedError;
+
+    // history ring of raw interleaved I/Q samples indexed by hardware
+    // sample number; it is filled before the Buffer fifo, so samples are
+    // kept even when the consumer falls behind and the fifo overflows
+    class History
+    {
+    public:
+        History(void);
+        ~History(void);
+
+        void resize(size_t numSamples);
+        void write(const short *xi, const short *xq, unsigned int numSamples, unsigned long long firstSampleNum);
+        size_t read(unsigned long long &firstSampleNum, size_t numSamples, short *buff);
+        bool getRange(unsigned long long &first, unsigned long long &last) const;
+
+        mutable std::mutex mutex;
+
+        // capacity != 0, readable without the lock
+        std::atomic_bool enabled;
+
+        std::vector<short> ring;
+        size_t capacity;
+        bool valid;
+        unsigned long long start;
+        unsigned long long end;
+    };
+
+    History _histA, _histB;
+
+    // compressed recorder of raw I/Q samples; the rx callback only queues
+    // blocks, encoding and file I/O run on the recorder thread
+    class Recorder
+    {
+    public:
+        Recorder(void);
+        ~Recorder(void);
+
+        bool start(const std::string &path);
+        void stop(void);
+        void write(const short *xi, const short *xq, unsigned int numSamples, unsigned long long firstSampleNum);
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::thread thread;
+        std::atomic_bool running;
+
+        std::ofstream file;
+        unsigned long long fileOffset;
+        std::vector<RecordingBlock> index;
+
+        std::vector<short> pending;
+        unsigned long long pendingFirstSampleNum;
+        std::deque<std::pair<unsigned long long, std::vector<short> > > queue;
+
+        std::atomic_ullong rawBytes;
+        std::atomic_ullong encodedBytes;
+        std::atomic_ullong droppedBlocks;
+
+    private:
+        void run(void);
+        void queuePending(void);
+    };
+
+    Recorder _recA, _recB;
 };
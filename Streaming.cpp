@@ -27,6 +27,9 @@
 
 #include "SoapySDRPlay3.hpp"
 
+// declared in Registration.cpp
+extern void invalidateCachedDevices(void);
+
 std::vector<std::string> SoapySDRPlay3::getStreamFormats(const int direction, const size_t channel) const 
 {
     std::vector<std::string> formats;
@@ -58,14 +61,14 @@ static void _rx_callback_A(short *xi, short *xq, sdrplay_api_StreamCbParamsT *pa
                            unsigned int numSamples, unsigned int reset, void *cbContext)
 {
     SoapySDRPlay3 *self = (SoapySDRPlay3 *)cbContext;
-    return self->rx_callback(xi, xq, numSamples, sdrplay_api_Tuner_A);
+    return self->rx_callback(xi, xq, params, numSamples, reset, sdrplay_api_Tuner_A);
 }
 
 static void _rx_callback_B(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params,
                            unsigned int numSamples, unsigned int reset, void *cbContext)
 {
     SoapySDRPlay3 *self = (SoapySDRPlay3 *)cbContext;
-    return self->rx_callback(xi, xq, numSamples, sdrplay_api_Tuner_B);
+    return self->rx_callback(xi, xq, params, numSamples, reset, sdrplay_api_Tuner_B);
 }
 
 static void _ev_callback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner,
@@ -75,36 +78,187 @@ static void _ev_callback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tu
     return self->ev_callback(eventId, tuner, params);
 }
 
-void SoapySDRPlay3::rx_callback(short *xi, short *xq, unsigned int numSamples, sdrplay_api_TunerSelectT tuner)
+void SoapySDRPlay3::rx_callback(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, sdrplay_api_TunerSelectT tuner)
 {
     Buffer *buf = 0;
-    if (tuner == sdrplay_api_Tuner_A)      { buf = _bufA; }
-    else if (tuner == sdrplay_api_Tuner_B) { buf = _bufB; }
+    History *hist = 0;
+    Recorder *rec = 0;
+    if (tuner == sdrplay_api_Tuner_A)      { buf = _bufA; hist = &_histA; rec = &_recA; }
+    else if (tuner == sdrplay_api_Tuner_B) { buf = _bufB; hist = &_histB; rec = &_recB; }
+
+    // extend the 32 bit hardware sample counter to 64 bits; after an API
+    // reset (or if the counter goes backwards) just carry on from where
+    // the previous block ended
+    unsigned long long sampleNum;
+    if (!buf->sampleNumValid)
+    {
+        sampleNum = params->firstSampleNum;
+        buf->sampleNumValid = true;
+    }
+    else
+    {
+        unsigned int delta = params->firstSampleNum - (unsigned int)buf->nextSampleNum;
+        sampleNum = buf->nextSampleNum;
+        if (!reset && delta < 0x80000000U)
+        {
+            sampleNum += delta;
+        }
+    }
+    buf->nextSampleNum = sampleNum + numSamples;
+    if (tuner == sdrplay_api_Tuner_A)
+    {
+        updateTimeBase(sampleNum, numSamples);
+    }
+
+    TunerState &state = (tuner == sdrplay_api_Tuner_B) ? _stateB : _stateA;
+    state.callbacks++;
+    state.samplesReceived += numSamples;
+
+    // callback cadence; the first callback after activation or an API
+    // reset has no meaningful interval
+    long long nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    long long lastNs = state.lastCallbackNs.exchange(nowNs);
+    if (lastNs != 0 && !reset && nowNs > lastNs)
+    {
+        unsigned long long intervalNs = nowNs - lastNs;
+        state.callbackInterval.record(intervalNs);
+        uint32_t rate = reqSampleRate;
+        if (rate > 0 && intervalNs > DEFAULT_STALL_FACTOR * 1e9 * numSamples / rate)
+        {
+            state.stalls++;
+        }
+    }
+    state.callbackSamples.record(numSamples);
+
+    hist->write(xi, xq, numSamples, sampleNum);
+    rec->write(xi, xq, numSamples, sampleNum);
+
+    if (sweeping && tuner == sdrplay_api_Tuner_A)
+    {
+        sweepCallback(xi, xq, params, numSamples);
+        return;
+    }
+
+    double hopTag = 0.0;
+    if (hopping && tuner == sdrplay_api_Tuner_A)
+    {
+        if (!hopCallback(params, numSamples))
+        {
+            return;
+        }
+        hopTag = hopFrequency;
+    }
+
+    // the API reports a change from the first sample of the block on
+    int changes = buf->pendingChanges.exchange(0);
+    if (params->grChanged) changes |= SOAPY_SDRPLAY_GAIN_CHANGED;
+    if (params->rfChanged) changes |= SOAPY_SDRPLAY_FREQUENCY_CHANGED;
+    if (params->fsChanged) changes |= SOAPY_SDRPLAY_RATE_CHANGED;
+
+    // report where the timed commands waiting for these changes landed
+    if (tuner == sdrplay_api_Tuner_A)
+    {
+        if (params->grChanged) timedLanding(SOAPY_SDRPLAY_GAIN_CHANGED, sampleNum);
+        if (params->rfChanged) timedLanding(SOAPY_SDRPLAY_FREQUENCY_CHANGED, sampleNum);
+    }
+
+    // deactivated in standby mode; keep the changes for the first block
+    // delivered after it
+    if (streamGated)
+    {
+        buf->pendingChanges |= changes;
+        return;
+    }
+
     std::lock_guard<std::mutex> lock(buf->mutex);
 
+    // finite burst: deliver the samples from the start time on and stop
+    // after the requested number
+    bool endBurst = false;
+    if (buf->burstActive)
+    {
+        if (buf->burstDone)
+        {
+            return;
+        }
+        if (buf->burstWaitStart)
+        {
+            long long aheadNs = buf->burstStartNs - sampleToTimeNs(sampleNum);
+            unsigned long long skip = 0;
+            if (aheadNs > 0)
+            {
+                skip = (unsigned long long)std::ceil((double)aheadNs * reqSampleRate / 1e9);
+            }
+            if (skip >= numSamples)
+            {
+                buf->pendingChanges |= changes;
+                return;
+            }
+            buf->burstWaitStart = false;
+            xi += skip;
+            xq += skip;
+            numSamples -= (unsigned int)skip;
+            sampleNum += skip;
+        }
+        if (buf->burstLimited)
+        {
+            if (numSamples >= buf->burstRemaining)
+            {
+                numSamples = (unsigned int)buf->burstRemaining;
+                endBurst = true;
+            }
+            buf->burstRemaining -= numSamples;
+        }
+    }
+
+    // a burst can't go on past a gap: the overflow ends it, and the
+    // reader gets SOAPY_SDR_END_BURST with the overflow
     if (buf->count == numBuffers)
     {
+        if (!buf->overflowEvent)
+        {
+            state.overflows++;
+        }
+        state.samplesDroppedFull += numSamples;
         buf->overflowEvent = true;
+        buf->pendingChanges |= changes;
+        if (buf->burstActive)
+        {
+            buf->burstDone = true;
+        }
         return;
     }
 
+    // every buffer holds samples of a single hop and starts at a change;
+    // a block larger than the slot size goes in a slot of its own, but an
+    // empty slot is never published
     int spaceReqd = numSamples * elementsPerSample * shortsPerWord;
-    if ((buf->buffs[buf->tail].size() + spaceReqd) >= (bufferLength / chParams->ctrlParams.decimation.decimationFactor))
+    if (!buf->buffs[buf->tail].empty() &&
+        ((buf->buffs[buf->tail].size() + spaceReqd) >= (bufferLength / decimationFactor) ||
+         buf->frequency[buf->tail] != hopTag || changes))
     {
-       // increment the tail pointer and buffer count
-       buf->tail = (buf->tail + 1) % numBuffers;
-       buf->count++;
-
-       // notify readStream()
-       buf->cond.notify_one();
+       publishBuffer(buf);
+    }
+    buf->frequency[buf->tail] = hopTag;
+    buf->changes[buf->tail] |= changes;
+    if (buf->buffs[buf->tail].empty())
+    {
+        buf->firstSample[buf->tail] = sampleNum;
     }
 
     // get current fill buffer
     auto &buff = buf->buffs[buf->tail];
     buff.resize(buff.size() + spaceReqd);
 
-    // copy into the buffer queue
+    // copy into the buffer queue, accumulating the signal statistics in
+    // the same pass; the plain integer reductions let the compiler
+    // vectorize the loops
     unsigned int i = 0;
+    long long sumI = 0;
+    long long sumQ = 0;
+    unsigned long long sumPower = 0;
+    unsigned int peakPower = 0;
+    unsigned long clipped = 0;
 
     if (useShort)
     {
@@ -112,8 +266,16 @@ void SoapySDRPlay3::rx_callback(short *xi, short *xq, unsigned int numSamples, s
        dptr += (buff.size() - spaceReqd);
        for (i = 0; i < numSamples; i++)
        {
+           int si = xi[i];
+           int sq = xq[i];
            *dptr++ = xi[i];
            *dptr++ = xq[i];
+           unsigned int power = (unsigned int)(si * si) + (unsigned int)(sq * sq);
+           sumI += si;
+           sumQ += sq;
+           sumPower += power;
+           peakPower = std::max(peakPower, power);
+           clipped += (std::abs(si) >= DEFAULT_CLIP_LEVEL) | (std::abs(sq) >= DEFAULT_CLIP_LEVEL);
         }
     }
     else
@@ -122,16 +284,134 @@ void SoapySDRPlay3::rx_callback(short *xi, short *xq, unsigned int numSamples, s
        dptr += ((buff.size() - spaceReqd) / shortsPerWord);
        for (i = 0; i < numSamples; i++)
        {
+          int si = xi[i];
+          int sq = xq[i];
           *dptr++ = (float)xi[i] / 32768.0f;
           *dptr++ = (float)xq[i] / 32768.0f;
+          unsigned int power = (unsigned int)(si * si) + (unsigned int)(sq * sq);
+          sumI += si;
+          sumQ += sq;
+          sumPower += power;
+          peakPower = std::max(peakPower, power);
+          clipped += (std::abs(si) >= DEFAULT_CLIP_LEVEL) | (std::abs(sq) >= DEFAULT_CLIP_LEVEL);
        }
     }
 
+    BufferStats &stats = buf->stats[buf->tail];
+    stats.numSamples += numSamples;
+    stats.sumI += sumI;
+    stats.sumQ += sumQ;
+    stats.sumPower += sumPower;
+    stats.peakPower = std::max(stats.peakPower, peakPower);
+    stats.clipped += clipped;
+
+    if (endBurst)
+    {
+        buf->changes[buf->tail] |= SOAPY_SDR_END_BURST;
+        publishBuffer(buf);
+        buf->burstDone = true;
+    }
+
     return;
 }
 
+// called with buf->mutex held
+void SoapySDRPlay3::publishBuffer(Buffer *buf)
+{
+    // publish the statistics of the completed buffer
+    updateAverageStats(buf, buf->stats[buf->tail]);
+    buf->publishTime[buf->tail] = std::chrono::steady_clock::now();
+
+    // increment the tail pointer and buffer count
+    buf->tail = (buf->tail + 1) % numBuffers;
+    buf->count++;
+    std::memset(&buf->stats[buf->tail], 0, sizeof(BufferStats));
+    buf->changes[buf->tail] = 0;
+
+    // notify readStream()
+    buf->cond.notify_one();
+}
+
+// drains all buffers from the fifo; called with buf->mutex held
+void SoapySDRPlay3::drainBuffer(Buffer *buf)
+{
+    buf->tail = 0;
+    buf->head = 0;
+    buf->count = 0;
+    for (auto &buff : buf->buffs) buff.clear();
+    for (auto &st : buf->stats) std::memset(&st, 0, sizeof(BufferStats));
+    for (auto &ch : buf->changes) ch = 0;
+}
+
+// empties the fifo after a reset or an overflow; returns true for an
+// overflow; buf->mutex held
+bool SoapySDRPlay3::flushBuffer(Buffer *buf)
+{
+    TunerState &state = (buf == _bufB) ? _stateB : _stateA;
+    size_t flushed = 0;
+    for (auto &buff : buf->buffs) flushed += buff.size();
+    state.samplesDroppedFlush += flushed / (elementsPerSample * shortsPerWord);
+    if (buf->reset) state.resets++;
+
+    drainBuffer(buf);
+    bool overflow = !buf->reset && buf->overflowEvent;
+    buf->overflowEvent = false;
+    buf->reset = false;
+    return overflow;
+}
+
+static float powerToDbfs(double power)
+{
+    // power relative to a full scale (32768) sinusoid; floor at -200dBFS
+    return (float)(10.0 * std::log10(std::max(power / (32768.0 * 32768.0), 1e-20)));
+}
+
+void SoapySDRPlay3::updateAverageStats(Buffer *buf, const BufferStats &stats)
+{
+    if (stats.numSamples == 0)
+    {
+        return;
+    }
+
+    float power = powerToDbfs((double)stats.sumPower / stats.numSamples);
+    float peak = powerToDbfs((double)stats.peakPower);
+    float dcI = (float)((double)stats.sumI / stats.numSamples / 32768.0);
+    float dcQ = (float)((double)stats.sumQ / stats.numSamples / 32768.0);
+    float clip = (float)stats.clipped / stats.numSamples;
+
+    // the first buffer seeds the averages; the peak is a running maximum
+    // with a decay rather than an average
+    const float a = buf->avgValid ? DEFAULT_STATS_AVERAGING : 1.0f;
+    buf->avgValid = true;
+    buf->avgPower = buf->avgPower + a * (power - buf->avgPower);
+    buf->avgPeak = std::max(peak, buf->avgPeak + a * (peak - buf->avgPeak));
+    buf->avgDcI = buf->avgDcI + a * (dcI - buf->avgDcI);
+    buf->avgDcQ = buf->avgDcQ + a * (dcQ - buf->avgDcQ);
+    buf->avgClipped = buf->avgClipped + a * (clip - buf->avgClipped);
+}
+
+std::string SoapySDRPlay3::statsToString(const BufferStats &stats)
+{
+    if (stats.numSamples == 0)
+    {
+        return "";
+    }
+    char str[256];
+    snprintf(str, sizeof(str), "samples=%lu,power_dbfs=%.2f,peak_dbfs=%.2f,dc_i=%.6f,dc_q=%.6f,clipped=%lu",
+             stats.numSamples,
+             powerToDbfs((double)stats.sumPower / stats.numSamples),
+             powerToDbfs((double)stats.peakPower),
+             (double)stats.sumI / stats.numSamples / 32768.0,
+             (double)stats.sumQ / stats.numSamples / 32768.0,
+             stats.clipped);
+    return str;
+}
+
 void SoapySDRPlay3::ev_callback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner, sdrplay_api_EventParamsT *params)
 {
+    // in single tuner mode all the events belong to the one channel
+    TunerState &state = (tuner == sdrplay_api_Tuner_B && nchannels > 1) ? _stateB : _stateA;
+
     if (eventId == sdrplay_api_GainChange)
     {
         //Beware, lnaGRdB is really the LNA GR, NOT the LNA state !
@@ -143,19 +423,32 @@ void SoapySDRPlay3::ev_callback(sdrplay_api_EventT eventId, sdrplay_api_TunerSel
         //{
         //    current_gRdB = gRdB;
         //}
+        state.currGain = params->gainParams.currGain;
+        if (&state == &_stateA)
+        {
+            publishGain(params->gainParams.currGain);
+        }
+    }
+    else if (eventId == sdrplay_api_DeviceRemoved)
+    {
+        // the enumeration cache no longer reflects the devices
+        invalidateCachedDevices();
+        SoapySDR_log(SOAPY_SDR_WARNING, "Device removed");
     }
     else if (eventId == sdrplay_api_PowerOverloadChange)
     {
         sdrplay_api_PowerOverloadCbEventIdT powerOverloadChangeType = params->powerOverloadParams.powerOverloadChangeType;
         if (powerOverloadChangeType == sdrplay_api_Overload_Detected)
         {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Ctrl_OverloadMsgAck, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_Ctrl_OverloadMsgAck, sdrplay_api_Update_Ext1_None);
             // OVERLOAD DETECTED
+            state.overload = true;
         }
         else if (powerOverloadChangeType == sdrplay_api_Overload_Corrected)
         {
-            sdrplay_api_Update(device.dev, device.tuner, sdrplay_api_Update_Ctrl_OverloadMsgAck, sdrplay_api_Update_Ext1_None);
+            updateDevice(sdrplay_api_Update_Ctrl_OverloadMsgAck, sdrplay_api_Update_Ext1_None);
             // OVERLOAD CORRECTED
+            state.overload = false;
         }
     }
 }
@@ -177,12 +470,170 @@ SoapySDRPlay3::Buffer::Buffer(size_t numBuffers, unsigned long bufferLength)
     buffs.resize(numBuffers);
     for (auto &buff : buffs) buff.reserve(bufferLength);
     for (auto &buff : buffs) buff.clear();
+
+    stats.resize(numBuffers);
+    for (auto &st : stats) std::memset(&st, 0, sizeof(BufferStats));
+    publishTime.resize(numBuffers);
+    frequency.assign(numBuffers, 0.0);
+    currentFrequency = 0.0;
+    changes.assign(numBuffers, 0);
+    firstSample.assign(numBuffers, 0);
+    currentSample = 0;
+    currentEndBurst = false;
+    burstActive = false;
+    burstWaitStart = false;
+    burstStartNs = 0;
+    burstLimited = false;
+    burstRemaining = 0;
+    burstDone = false;
+    pendingChanges = 0;
+    std::memset(&currentStats, 0, sizeof(BufferStats));
+    avgPower = -200.0f;
+    avgPeak = -200.0f;
+    avgDcI = 0.0f;
+    avgDcQ = 0.0f;
+    avgClipped = 0.0f;
+    avgValid = false;
+
+    nextSampleNum = 0;
+    sampleNumValid = false;
 }
 
 SoapySDRPlay3::Buffer::~Buffer()
 {
 }
 
+SoapySDRPlay3::TunerState::TunerState(void)
+{
+    overload = false;
+    currGain = 0.0;
+    overflows = 0;
+    callbacks = 0;
+    samplesReceived = 0;
+    samplesRead = 0;
+    samplesDroppedFull = 0;
+    samplesDroppedFlush = 0;
+    resets = 0;
+    timeouts = 0;
+    stalls = 0;
+    lastCallbackNs = 0;
+}
+
+SoapySDRPlay3::History::History(void)
+{
+    enabled = false;
+    capacity = 0;
+    valid = false;
+    start = 0;
+    end = 0;
+}
+
+SoapySDRPlay3::History::~History()
+{
+}
+
+void SoapySDRPlay3::History::resize(size_t numSamples)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // release the memory when the history is disabled
+    std::vector<short>(numSamples * DEFAULT_ELEMS_PER_SAMPLE).swap(ring);
+    capacity = numSamples;
+    enabled = (numSamples != 0);
+    valid = false;
+    start = 0;
+    end = 0;
+}
+
+void SoapySDRPlay3::History::write(const short *xi, const short *xq, unsigned int numSamples, unsigned long long firstSampleNum)
+{
+    // history_seconds=0 costs the stream callback a flag check only
+    if (!enabled)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (capacity == 0)
+    {
+        return;
+    }
+
+    if (!valid || firstSampleNum < end)
+    {
+        // first block or the counter went backwards: start over
+        start = firstSampleNum;
+        end = firstSampleNum;
+        valid = true;
+    }
+    else if (firstSampleNum > end)
+    {
+        // samples missing from the stream are stored as zeros, so that
+        // the ring position always matches the sample number
+        unsigned long long gap = std::min((unsigned long long)capacity, firstSampleNum - end);
+        for (unsigned long long n = firstSampleNum - gap; n < firstSampleNum; n++)
+        {
+            size_t pos = (size_t)(n % capacity) * DEFAULT_ELEMS_PER_SAMPLE;
+            ring[pos] = 0;
+            ring[pos + 1] = 0;
+        }
+        end = firstSampleNum;
+    }
+
+    size_t pos = (size_t)(end % capacity);
+    for (unsigned int i = 0; i < numSamples; i++)
+    {
+        ring[pos * DEFAULT_ELEMS_PER_SAMPLE] = xi[i];
+        ring[pos * DEFAULT_ELEMS_PER_SAMPLE + 1] = xq[i];
+        if (++pos == capacity) pos = 0;
+    }
+    end += numSamples;
+
+    if (end - start > capacity)
+    {
+        start = end - capacity;
+    }
+}
+
+size_t SoapySDRPlay3::History::read(unsigned long long &firstSampleNum, size_t numSamples, short *buff)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (capacity == 0 || !valid)
+    {
+        return 0;
+    }
+
+    // clip the requested range to what is still in the ring
+    unsigned long long first = std::max(firstSampleNum, start);
+    unsigned long long last = std::min(firstSampleNum + numSamples, end);
+    firstSampleNum = first;
+    if (first >= last)
+    {
+        return 0;
+    }
+
+    size_t pos = (size_t)(first % capacity);
+    size_t n = (size_t)(last - first);
+    for (size_t i = 0; i < n; i++)
+    {
+        *buff++ = ring[pos * DEFAULT_ELEMS_PER_SAMPLE];
+        *buff++ = ring[pos * DEFAULT_ELEMS_PER_SAMPLE + 1];
+        if (++pos == capacity) pos = 0;
+    }
+    return n;
+}
+
+bool SoapySDRPlay3::History::getRange(unsigned long long &first, unsigned long long &last) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    first = start;
+    last = end;
+    return capacity != 0 && valid;
+}
+
 SoapySDR::Stream *SoapySDRPlay3::setupStream(const int direction,
                                              const std::string &format,
                                              const std::vector<size_t> &channels,
@@ -233,6 +684,7 @@ SoapySDR::Stream *SoapySDRPlay3::setupStream(const int direction,
 
     if (nchannels >= 1) _bufA = new Buffer(numBuffers, bufferLength);
     if (nchannels >= 2) _bufB = new Buffer(numBuffers, bufferLength);
+    streamSetup = true;
 
     return (SoapySDR::Stream *) this;
 }
@@ -246,6 +698,8 @@ void SoapySDRPlay3::closeStream(SoapySDR::Stream *stream)
         sdrplay_api_Uninit(device.dev);
     }
     streamActive = false;
+    streamGated = false;
+    streamSetup = false;
 }
 
 size_t SoapySDRPlay3::getStreamMTU(SoapySDR::Stream *stream) const
@@ -259,26 +713,82 @@ int SoapySDRPlay3::activateStream(SoapySDR::Stream *stream,
                                  const long long timeNs,
                                  const size_t numElems)
 {
-    if (flags != 0) 
+    // a burst of numElems samples (END_BURST) and/or starting at timeNs
+    // (HAS_TIME)
+    if ((flags & ~(SOAPY_SDR_END_BURST | SOAPY_SDR_HAS_TIME)) != 0)
+    {
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+    if ((flags & SOAPY_SDR_END_BURST) && numElems == 0)
     {
         return SOAPY_SDR_NOT_SUPPORTED;
     }
-   
-    if (_bufA)
+    // the start time is in the time base of tuner A, whose sample counter
+    // tuner B doesn't share
+    if ((flags & SOAPY_SDR_HAS_TIME) && nchannels > 1)
     {
-        _bufA->reset = true;
-        _bufA->nElems = 0;
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    for (Buffer *buf : {_bufA, _bufB})
+    {
+        if (!buf) continue;
+        std::lock_guard<std::mutex> bufLock(buf->mutex);
+        buf->nElems = 0;
+        if (flags != 0)
+        {
+            // the burst may be over before the first read, so the fifo
+            // cannot be reset by the reader
+            drainBuffer(buf);
+            buf->overflowEvent = false;
+            buf->reset = false;
+        }
+        else
+        {
+            buf->reset = true;
+        }
+        buf->burstActive = (flags != 0);
+        buf->burstWaitStart = (flags & SOAPY_SDR_HAS_TIME) != 0;
+        buf->burstStartNs = timeNs;
+        buf->burstLimited = (flags & SOAPY_SDR_END_BURST) != 0;
+        buf->burstRemaining = numElems;
+        buf->burstDone = false;
     }
-    if (_bufB)
+    _stateA.lastCallbackNs = 0;
+    _stateB.lastCallbackNs = 0;
     {
-        _bufB->reset = true;
-        _bufB->nElems = 0;
+        std::lock_guard<std::mutex> awaitLock(_timed_await_mutex);
+        timedAwait.clear();
+        rfChangesReported = rfUpdatesIssued;
+        grChangesReported = grUpdatesIssued;
     }
     
     sdrplay_api_ErrT err;
     
     std::lock_guard <std::mutex> lock(_general_state_mutex);
 
+    // warm standby: the device kept streaming, only the delivery resumes
+    if (streamActive && streamGated)
+    {
+        streamGated = false;
+        return 0;
+    }
+
+    err = initStream();
+    if (err != sdrplay_api_Success)
+    {
+       //throw std::runtime_error("Init Error: " + std::to_string(err));
+       return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    streamActive = true;
+    
+    return 0;
+}
+
+// starts the device streaming into the callbacks; _general_state_mutex held
+sdrplay_api_ErrT SoapySDRPlay3::initStream(void)
+{
     // Enable (= sdrplay_api_DbgLvl_Verbose) API calls tracing,
     // but only for debug purposes due to its performance impact.
     sdrplay_api_DebugEnable(device.dev, sdrplay_api_DbgLvl_Disable);
@@ -297,16 +807,7 @@ int SoapySDRPlay3::activateStream(SoapySDR::Stream *stream,
     cbFns.StreamBCbFn = _rx_callback_B;
     cbFns.EventCbFn = _ev_callback;
 
-    err = sdrplay_api_Init(device.dev, &cbFns, (void *)this);
-    if (err != sdrplay_api_Success)
-    {
-       //throw std::runtime_error("Init Error: " + std::to_string(err));
-       return SOAPY_SDR_NOT_SUPPORTED;
-    }
-
-    streamActive = true;
-    
-    return 0;
+    return sdrplay_api_Init(device.dev, &cbFns, (void *)this);
 }
 
 int SoapySDRPlay3::deactivateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs)
@@ -318,12 +819,21 @@ int SoapySDRPlay3::deactivateStream(SoapySDR::Stream *stream, const int flags, c
 
     std::lock_guard <std::mutex> lock(_general_state_mutex);
 
+    // in standby mode the device keeps streaming (and its DC offset and
+    // AGC loops converged) and only the delivery into the fifo stops
+    if (standbyMode && streamActive)
+    {
+        streamGated = true;
+        return 0;
+    }
+
     if (streamActive)
     {
         sdrplay_api_Uninit(device.dev);
     }
 
     streamActive = false;
+    streamGated = false;
     
     return 0;
 }
@@ -335,7 +845,7 @@ int SoapySDRPlay3::readStream(SoapySDR::Stream *stream,
                              long long &timeNs,
                              const long timeoutUs)
 {
-    if (!streamActive) 
+    if (!streamActive || streamGated) 
     {
         return 0;
     }
@@ -344,7 +854,9 @@ int SoapySDRPlay3::readStream(SoapySDR::Stream *stream,
     if (nchannels <= 1) {
        return retA;
     }
-    int retB = readChannel(stream, buffs[1], numElems, flags, timeNs, timeoutUs, _bufB);
+    int flagsB = 0;
+    int retB = readChannel(stream, buffs[1], numElems, flagsB, timeNs, timeoutUs, _bufB);
+    flags |= flagsB;
     if (retA < 0)
     {
         return retA;
@@ -368,6 +880,8 @@ int SoapySDRPlay3::readChannel(SoapySDR::Stream *stream,
                                const long timeoutUs,
                                Buffer *daBuf)
 {
+    flags = 0;
+
     // are elements left in the buffer? if not, do a new read.
     if (daBuf->nElems == 0)
     {
@@ -382,6 +896,13 @@ int SoapySDRPlay3::readChannel(SoapySDR::Stream *stream,
 
     size_t returnedElems = std::min(daBuf->nElems.load(), numElems);
 
+    // time of the first sample of this read
+    if (sampleToTimeNs(daBuf->currentSample, timeNs))
+    {
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+    daBuf->currentSample += returnedElems;
+
     // copy into user's buff
     if (useShort)
     {
@@ -401,14 +922,20 @@ int SoapySDRPlay3::readChannel(SoapySDR::Stream *stream,
         daBuf->currentBuff += returnedElems * elementsPerSample * shortsPerWord;
     }
 
-    // return number of elements written to buff
+    // return number of elements written to buff; the end of a burst is
+    // flagged on the read of its last sample
     if (daBuf->nElems != 0)
     {
+        flags &= ~SOAPY_SDR_END_BURST;
         flags |= SOAPY_SDR_MORE_FRAGMENTS;
     }
     else
     {
-        this->releaseReadBuffer(stream, daBuf->currentHandle);
+        if (daBuf->currentEndBurst)
+        {
+            flags |= SOAPY_SDR_END_BURST;
+        }
+        releaseBuffer(daBuf, daBuf->currentHandle);
     }
     return (int)returnedElems;
 }
@@ -447,25 +974,63 @@ int SoapySDRPlay3::acquireReadBuffer(SoapySDR::Stream *stream,
                                      const long timeoutUs,
                                      Buffer *daBuf)
 {
+    // the application acquires the buffers of all the channels at once,
+    // with the same handle
+    if (!daBuf)
+    {
+        if (nchannels > 1)
+        {
+            // keep the fifos of the two channels in step: a reset or an
+            // overflow of either flushes both
+            std::lock(_bufA->mutex, _bufB->mutex);
+            std::lock_guard <std::mutex> lockA(_bufA->mutex, std::adopt_lock);
+            std::lock_guard <std::mutex> lockB(_bufB->mutex, std::adopt_lock);
+            if (_bufA->reset || _bufA->overflowEvent || _bufB->reset || _bufB->overflowEvent)
+            {
+                bool endA = _bufA->burstActive && _bufA->burstDone;
+                bool endB = _bufB->burstActive && _bufB->burstDone;
+                bool overflowA = flushBuffer(_bufA);
+                bool overflowB = flushBuffer(_bufB);
+                if (overflowA || overflowB)
+                {
+                    SoapySDR_log(SOAPY_SDR_SSI, "O");
+                    flags = (endA || endB) ? SOAPY_SDR_END_BURST : 0;
+                    return SOAPY_SDR_OVERFLOW;
+                }
+            }
+        }
+        int ret = acquireReadBuffer(stream, handle, &buffs[0], flags, timeNs, timeoutUs, _bufA);
+        if (ret < 0 || nchannels <= 1)
+        {
+            return ret;
+        }
+        size_t handleB;
+        int flagsB = 0;
+        long long timeNsB;
+        int retB = acquireReadBuffer(stream, handleB, &buffs[1], flagsB, timeNsB, timeoutUs, _bufB);
+        if (retB < 0)
+        {
+            // leave the buffer of channel A for the next call
+            std::lock_guard <std::mutex> lockA(_bufA->mutex);
+            _bufA->head = handle;
+            return retB;
+        }
+        flags |= flagsB;
+        return std::min(ret, retB);
+    }
+
     std::unique_lock <std::mutex> lock(daBuf->mutex);
+    TunerState &state = (daBuf == _bufB) ? _stateB : _stateA;
 
     // reset is issued by various settings
     // overflow set in the rx callback thread
     if (daBuf->reset || daBuf->overflowEvent)
     {
-        // drain all buffers from the fifo
-        daBuf->tail = 0;
-        daBuf->head = 0;
-        daBuf->count = 0;
-        for (auto &buff : daBuf->buffs) buff.clear();
-        daBuf->overflowEvent = false;
-        if (daBuf->reset)
-        {
-           daBuf->reset = false;
-        }
-        else
+        bool endBurst = daBuf->burstActive && daBuf->burstDone;
+        if (flushBuffer(daBuf))
         {
            SoapySDR_log(SOAPY_SDR_SSI, "O");
+           flags = endBurst ? SOAPY_SDR_END_BURST : 0;
            return SOAPY_SDR_OVERFLOW;
         }
     }
@@ -476,6 +1041,7 @@ int SoapySDRPlay3::acquireReadBuffer(SoapySDR::Stream *stream,
         daBuf->cond.wait_for(lock, std::chrono::microseconds(timeoutUs));
         if (daBuf->count == 0) 
         {
+           state.timeouts++;
            return SOAPY_SDR_TIMEOUT;
         }
     }
@@ -483,7 +1049,17 @@ int SoapySDRPlay3::acquireReadBuffer(SoapySDR::Stream *stream,
     // extract handle and buffer
     handle = daBuf->head;
     buffs[0] = (void *)daBuf->buffs[handle].data();
-    flags = 0;
+    flags = daBuf->changes[handle];
+    daBuf->currentEndBurst = (flags & SOAPY_SDR_END_BURST) != 0;
+    daBuf->currentSample = daBuf->firstSample[handle];
+    if (sampleToTimeNs(daBuf->currentSample, timeNs))
+    {
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+    daBuf->currentStats = daBuf->stats[handle];
+    daBuf->currentFrequency = daBuf->frequency[handle];
+    state.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - daBuf->publishTime[handle]).count());
+    state.samplesRead += daBuf->buffs[handle].size() / (elementsPerSample * shortsPerWord);
 
     daBuf->head = (daBuf->head + 1) % numBuffers;
 
@@ -493,13 +1069,36 @@ int SoapySDRPlay3::acquireReadBuffer(SoapySDR::Stream *stream,
 
 void SoapySDRPlay3::releaseReadBuffer(SoapySDR::Stream *stream, const size_t handle)
 {
-    std::lock_guard <std::mutex> lockA(_bufA->mutex);
-    _bufA->buffs[handle].clear();
-    _bufA->count--;
+    releaseBuffer(_bufA, handle);
     if (nchannels > 1)
     {
-        std::lock_guard <std::mutex> lockA(_bufB->mutex);
-        _bufB->buffs[handle].clear();
-        _bufB->count--;
+        releaseBuffer(_bufB, handle);
     }
 }
+
+void SoapySDRPlay3::releaseBuffer(Buffer *buf, const size_t handle)
+{
+    std::lock_guard <std::mutex> lock(buf->mutex);
+    buf->buffs[handle].clear();
+    buf->count--;
+}
+
+/*******************************************************************
+ * History API
+ ******************************************************************/
+
+size_t SoapySDRPlay3::readHistory(const size_t channel,
+                                  unsigned long long &firstSampleNum,
+                                  const size_t numSamples,
+                                  short *buff)
+{
+    if (channel == 0)
+    {
+        return _histA.read(firstSampleNum, numSamples, buff);
+    }
+    else if (channel == 1)
+    {
+        return _histB.read(firstSampleNum, numSamples, buff);
+    }
+    return 0;
+}
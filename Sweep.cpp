@@ -0,0 +1,242 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "SoapySDRPlay3.hpp"
+
+/*******************************************************************
+ * Wideband sweep
+ *
+ * The sweep steps the tuner across [sweepStart, sweepStop): for each
+ * step the rx callback waits for the frequency change to land
+ * (rfChanged), then captures fftSize * averages samples and hands them
+ * to the sweep thread, which computes the averaged power spectrum,
+ * trims the band edges and stitches the remaining bins into the sweep
+ * spectrum. The samples are not delivered to the stream while sweeping.
+ ******************************************************************/
+
+static const double SWEEP_PI = 3.14159265358979323846;
+
+// in place radix-2 decimation in time FFT
+static void fft(std::vector<std::complex<float> > &x, const std::vector<std::complex<float> > &twiddle)
+{
+    size_t n = x.size();
+    for (size_t i = 1, j = 0; i < n; i++)
+    {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(x[i], x[j]);
+    }
+    for (size_t len = 2; len <= n; len <<= 1)
+    {
+        size_t stride = n / len;
+        for (size_t i = 0; i < n; i += len)
+        {
+            for (size_t j = 0; j < len / 2; j++)
+            {
+                std::complex<float> u = x[i + j];
+                std::complex<float> v = x[i + j + len / 2] * twiddle[j * stride];
+                x[i + j] = u + v;
+                x[i + j + len / 2] = u - v;
+            }
+        }
+    }
+}
+
+void SoapySDRPlay3::startSweep(void)
+{
+    std::lock_guard<std::mutex> lock(_sweep_mutex);
+    if (sweepRunning)
+    {
+        return;
+    }
+    sweepRunning = true;
+    beginSweep();
+    sweepTunedHz = readSnapshot().rfHz;
+    tuneSweepStep();
+    sweeping = true;
+    sweepThread = std::thread(&SoapySDRPlay3::runSweep, this);
+}
+
+void SoapySDRPlay3::stopSweep(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(_sweep_mutex);
+        if (!sweepRunning)
+        {
+            return;
+        }
+        sweeping = false;
+        sweepRunning = false;
+    }
+    sweepCond.notify_one();
+    sweepThread.join();
+}
+
+// sets up the step geometry from the current settings; _sweep_mutex held
+void SoapySDRPlay3::beginSweep(void)
+{
+    unsigned int n = sweepFftSize;
+    sweepTrim = (unsigned int)(n * sweepOverlap);
+    unsigned int kept = n - 2 * sweepTrim;
+    sweepBinHz = (double)reqSampleRate / n;
+    size_t totalBins = (size_t)std::ceil((sweepStop - sweepStart) / sweepBinHz);
+    sweepSteps = (totalBins + kept - 1) / kept;
+    sweepStep = 0;
+    sweepAccum.assign(totalBins, -200.0f);
+    sweepCapture.resize((size_t)n * sweepAverages);
+}
+
+// retunes to the current step; _sweep_mutex held
+void SoapySDRPlay3::tuneSweepStep(void)
+{
+    unsigned int kept = sweepFftSize - 2 * sweepTrim;
+    double center = sweepStart + ((double)sweepStep * kept + (sweepFftSize / 2 - sweepTrim)) * sweepBinHz;
+    sweepCaptured = 0;
+    sweepSettleCount = 0;
+    if (center != sweepTunedHz)
+    {
+        sweepTunedHz = center;
+        sweepState = SWEEP_SETTLING;
+        queueControl(CONTROL_RF, center, true);
+    }
+    else
+    {
+        sweepState = SWEEP_CAPTURING;
+    }
+}
+
+void SoapySDRPlay3::sweepCallback(const short *xi, const short *xq, const sdrplay_api_StreamCbParamsT *params, unsigned int numSamples)
+{
+    std::lock_guard<std::mutex> lock(_sweep_mutex);
+
+    if (sweepState == SWEEP_SETTLING)
+    {
+        sweepSettleCount += numSamples;
+        if (!params->rfChanged)
+        {
+            if (sweepSettleCount < DEFAULT_HOP_SETTLE_TIMEOUT * reqSampleRate)
+            {
+                return;
+            }
+            sweepSettleTimeouts++;
+        }
+        sweepState = SWEEP_CAPTURING;
+    }
+    if (sweepState != SWEEP_CAPTURING)
+    {
+        return;
+    }
+
+    size_t n = std::min((size_t)numSamples, sweepCapture.size() - sweepCaptured);
+    std::complex<float> *dptr = &sweepCapture[sweepCaptured];
+    for (size_t i = 0; i < n; i++)
+    {
+        dptr[i] = std::complex<float>(xi[i] / 32768.0f, xq[i] / 32768.0f);
+    }
+    sweepCaptured += n;
+    if (sweepCaptured == sweepCapture.size())
+    {
+        sweepState = SWEEP_PROCESSING;
+        sweepCond.notify_one();
+    }
+}
+
+void SoapySDRPlay3::runSweep(void)
+{
+    std::unique_lock<std::mutex> lock(_sweep_mutex);
+
+    unsigned int n = 0;
+    std::vector<float> window;
+    std::vector<std::complex<float> > twiddle;
+    std::vector<std::complex<float> > segment;
+    std::vector<float> power;
+    float windowGain = 1.0f;
+
+    while (true)
+    {
+        sweepCond.wait(lock, [this]{ return !sweepRunning || sweepState == SWEEP_PROCESSING; });
+        if (!sweepRunning)
+        {
+            break;
+        }
+
+        if (n != sweepFftSize)
+        {
+            // Hann window, scaled so that a full scale tone reads 0dBFS
+            n = sweepFftSize;
+            window.resize(n);
+            twiddle.resize(n / 2);
+            segment.resize(n);
+            double sum = 0.0;
+            for (unsigned int i = 0; i < n; i++)
+            {
+                window[i] = (float)(0.5 - 0.5 * std::cos(2.0 * SWEEP_PI * i / n));
+                sum += window[i];
+            }
+            windowGain = (float)(1.0 / (sum * sum));
+            for (unsigned int i = 0; i < n / 2; i++)
+            {
+                twiddle[i] = std::polar(1.0f, (float)(-2.0 * SWEEP_PI * i / n));
+            }
+        }
+        unsigned int averages = sweepAverages;
+
+        // the callback leaves the capture alone while processing
+        lock.unlock();
+        power.assign(n, 0.0f);
+        for (unsigned int a = 0; a < averages; a++)
+        {
+            const std::complex<float> *src = &sweepCapture[(size_t)a * n];
+            for (unsigned int i = 0; i < n; i++) segment[i] = src[i] * window[i];
+            fft(segment, twiddle);
+            for (unsigned int i = 0; i < n; i++) power[i] += std::norm(segment[i]);
+        }
+        lock.lock();
+
+        // stitch the central bins (fft shifted) into the sweep
+        unsigned int kept = n - 2 * sweepTrim;
+        size_t offset = sweepStep * kept;
+        for (unsigned int k = 0; k < kept && offset + k < sweepAccum.size(); k++)
+        {
+            unsigned int bin = (sweepTrim + k + n / 2) % n;
+            float p = power[bin] * windowGain / averages;
+            sweepAccum[offset + k] = (float)(10.0 * std::log10(std::max(p, 1e-20f)));
+        }
+
+        sweepStep++;
+        if (sweepStep >= sweepSteps)
+        {
+            sweepSpectrum = sweepAccum;
+            sweepSpectrumStart = sweepStart;
+            sweepSpectrumBinHz = sweepBinHz;
+            sweepsCompleted++;
+            beginSweep();
+        }
+        tuneSweepStep();
+    }
+}
@@ -0,0 +1,219 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "SoapySDRPlay3.hpp"
+
+/*******************************************************************
+ * Time API
+ *
+ * The hardware time is the 64 bit sample counter of tuner A
+ * (firstSampleNum) converted to nanoseconds at the sample rate; the
+ * conversion is re-anchored whenever the rate changes so that the time
+ * stays continuous. readStream() returns the time of the first sample
+ * of each read.
+ ******************************************************************/
+
+bool SoapySDRPlay3::hasHardwareTime(const std::string &what) const
+{
+    return what.empty();
+}
+
+long long SoapySDRPlay3::getHardwareTime(const std::string &what) const
+{
+    std::lock_guard<std::mutex> lock(_time_mutex);
+    if (!timeValid)
+    {
+        return timeAnchorNs;
+    }
+    // time of the next sample, advanced by the time since it was announced
+    long long elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timeLastCallback).count();
+    return timeAnchorNs + (long long)((timeNextSample - timeAnchorSample) * 1e9 / timeAnchorRate) + elapsedNs;
+}
+
+void SoapySDRPlay3::setHardwareTime(const long long timeNs, const std::string &what)
+{
+    long long nowNs = getHardwareTime(what);
+    std::lock_guard<std::mutex> lock(_time_mutex);
+    timeAnchorNs += timeNs - nowNs;
+}
+
+// the following setFrequency() and setGain() calls are applied at
+// timeNs; 0 goes back to applying them right away
+void SoapySDRPlay3::setCommandTime(const long long timeNs, const std::string &what)
+{
+    commandTimeNs = timeNs;
+}
+
+// called by the rx callback of tuner A with the extended sample number
+// of the block
+void SoapySDRPlay3::updateTimeBase(unsigned long long sampleNum, unsigned int numSamples)
+{
+    uint32_t rate = reqSampleRate;
+    std::lock_guard<std::mutex> lock(_time_mutex);
+    if (rate == 0)
+    {
+        return;
+    }
+    if (!timeValid)
+    {
+        timeAnchorSample = sampleNum;
+        timeAnchorRate = rate;
+        timeValid = true;
+    }
+    else if (rate != timeAnchorRate)
+    {
+        timeAnchorNs += (long long)((sampleNum - timeAnchorSample) * 1e9 / timeAnchorRate);
+        timeAnchorSample = sampleNum;
+        timeAnchorRate = rate;
+    }
+    timeNextSample = sampleNum + numSamples;
+    timeLastCallback = std::chrono::steady_clock::now();
+}
+
+long long SoapySDRPlay3::sampleToTimeNs(unsigned long long sampleNum) const
+{
+    std::lock_guard<std::mutex> lock(_time_mutex);
+    if (!timeValid)
+    {
+        return timeAnchorNs;
+    }
+    return timeAnchorNs + (long long)(((long long)(sampleNum - timeAnchorSample)) * 1e9 / timeAnchorRate);
+}
+
+// false (and timeNs left alone) while there is no time base yet
+bool SoapySDRPlay3::sampleToTimeNs(unsigned long long sampleNum, long long &timeNs) const
+{
+    std::lock_guard<std::mutex> lock(_time_mutex);
+    if (!timeValid)
+    {
+        return false;
+    }
+    timeNs = timeAnchorNs + (long long)(((long long)(sampleNum - timeAnchorSample)) * 1e9 / timeAnchorRate);
+    return true;
+}
+
+// steady clock time at which the hardware time reaches timeNs; false if
+// there is no time base (stream not running)
+bool SoapySDRPlay3::timeToSteady(long long timeNs, std::chrono::steady_clock::time_point &when) const
+{
+    std::lock_guard<std::mutex> lock(_time_mutex);
+    if (!timeValid || !streamActive)
+    {
+        return false;
+    }
+    long long nextNs = timeAnchorNs + (long long)((timeNextSample - timeAnchorSample) * 1e9 / timeAnchorRate);
+    when = timeLastCallback + std::chrono::nanoseconds(timeNs - nextNs);
+    return true;
+}
+
+/*******************************************************************
+ * Timed control
+ *
+ * A command queued for time T is issued by the control thread when the
+ * hardware time reaches T minus the 99th percentile of the update
+ * latency, so that the API applies it at the first block boundary
+ * around T. The block where the change lands is reported through the
+ * readStream() flags and time (see rx_callback), and the difference
+ * from T is collected in timed_commands.
+ ******************************************************************/
+
+void SoapySDRPlay3::queueTimedControl(ControlKind kind, double value, long long timeNs)
+{
+    {
+        std::lock_guard<std::mutex> lock(_ctrl_mutex);
+        TimedControl command;
+        command.timeNs = timeNs;
+        command.kind = kind;
+        command.value = value;
+        // keep the queue sorted; commands for the same time stay in order
+        auto it = timedQueue.end();
+        while (it != timedQueue.begin() && (it - 1)->timeNs > timeNs) --it;
+        timedQueue.insert(it, command);
+        timedQueued++;
+        ctrlPending++;
+    }
+    startControlThread();
+    ctrlCond.notify_one();
+}
+
+// counts the updates that make the API report a frequency or gain
+// change; all of them are issued under _general_state_mutex
+void SoapySDRPlay3::countChangeUpdate(sdrplay_api_ReasonForUpdateT reasonForUpdate)
+{
+    if ((reasonForUpdate & (sdrplay_api_Update_Tuner_Frf | sdrplay_api_Update_Tuner_Gr)) == 0)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_timed_await_mutex);
+    if (reasonForUpdate & sdrplay_api_Update_Tuner_Frf) rfUpdatesIssued++;
+    if (reasonForUpdate & sdrplay_api_Update_Tuner_Gr) grUpdatesIssued++;
+}
+
+// called by the rx callback of tuner A for each change reported by the
+// API. The n-th change of a kind follows the n-th update that causes
+// it; a change with no update outstanding (AGC) is not counted. The
+// change lands the timed command issued with its update, if any
+void SoapySDRPlay3::timedLanding(int change, unsigned long long sampleNum)
+{
+    long long scheduledNs;
+    {
+        std::lock_guard<std::mutex> lock(_timed_await_mutex);
+        bool rf = (change == SOAPY_SDRPLAY_FREQUENCY_CHANGED);
+        unsigned long long &reported = rf ? rfChangesReported : grChangesReported;
+        if (reported == (rf ? rfUpdatesIssued : grUpdatesIssued))
+        {
+            return;
+        }
+        reported++;
+        bool found = false;
+        auto it = timedAwait.begin();
+        while (it != timedAwait.end())
+        {
+            if (it->change != change || it->seq > reported)
+            {
+                ++it;
+                continue;
+            }
+            // an earlier one whose change was never reported is dropped
+            if (it->seq == reported)
+            {
+                scheduledNs = it->timeNs;
+                found = true;
+            }
+            it = timedAwait.erase(it);
+        }
+        if (!found)
+        {
+            return;
+        }
+    }
+    long long landedNs = sampleToTimeNs(sampleNum);
+    timedError.record((unsigned long long)std::llabs(landedNs - scheduledNs));
+    timedLastLandedNs = landedNs;
+    timedLastLandedSample = sampleNum;
+    timedLanded++;
+}
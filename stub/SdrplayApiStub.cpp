@@ -0,0 +1,745 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*******************************************************************
+ * Stub sdrplay_api
+ *
+ * Implements the sdrplay_api entry points used by the module against
+ * simulated devices, so that the module can be built and exercised
+ * without the SDRplay service or any hardware. It is compiled against
+ * the sdrplay_api.h of the installed API; see SdrplayApiStub.h for the
+ * simulation controls.
+ ******************************************************************/
+
+#include <sdrplay_api.h>
+#include "SdrplayApiStub.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define STUB_MAX_BLOCK 8192
+#define STUB_TWO_PI 6.283185307179586
+
+namespace {
+
+struct StubConfig
+{
+    std::string devices = "RSP1A,RSPduo";
+    std::atomic<int> pacing{sdrplay_api_stub_RealTime};
+    std::atomic<unsigned int> blockSize{1008};
+    std::atomic<double> toneHz{100000.0};
+    std::atomic<double> amplitude{0.5};
+    std::atomic<unsigned int> jitterUs{0};
+    std::atomic<unsigned int> gapEvery{0};
+    std::atomic<unsigned int> gapSamples{0};
+};
+
+struct StubStats
+{
+    std::atomic<unsigned long long> blocks{0};
+    std::atomic<unsigned long long> samples{0};
+    std::atomic<unsigned long long> gaps{0};
+    std::atomic<unsigned long long> updates{0};
+    std::atomic<unsigned long long> inits{0};
+    std::atomic<unsigned long long> callbackNs{0};
+    std::atomic<unsigned long long> callbackNsMax{0};
+};
+
+struct StubDevice
+{
+    sdrplay_api_DeviceT info;
+    bool selected = false;
+    sdrplay_api_RspDuoModeT rspDuoMode = sdrplay_api_RspDuoMode_Unknown;
+    sdrplay_api_TunerSelectT tuner = sdrplay_api_Tuner_A;
+
+    sdrplay_api_DevParamsT devParams;
+    sdrplay_api_RxChannelParamsT rxA, rxB;
+    sdrplay_api_DeviceParamsT params;
+
+    // streaming state; the rate and the pending change flags are
+    // snapshots taken by Init and Update, so that the stream thread
+    // never reads the parameter structures the application writes
+    bool initialised = false;
+    sdrplay_api_CallbackFnsT callbacks;
+    void *cbContext = 0;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::recursive_mutex stepMutex;  // recursive: a callback may call sdrplay_api_Update
+    std::atomic<double> sampleRate{2000000.0};
+    std::atomic<double> rfHzA{0.0}, rfHzB{0.0};
+    std::atomic<int> pendingChanges{0};
+    std::atomic<int> pendingGrA{-1}, pendingGrB{-1};
+    unsigned int sampleNum = 0;
+    unsigned long long blockNum = 0;
+    double phase = 0.0;
+    bool first = true;
+    std::chrono::steady_clock::time_point deadline;
+    std::vector<short> xiA, xqA, xiB, xqB;
+};
+
+enum
+{
+    PENDING_GR = 1,
+    PENDING_RF = 2,
+    PENDING_FS = 4,
+};
+
+std::mutex stubMutex;
+StubConfig config;
+StubStats stats;
+bool configured = false;
+int openCount = 0;
+std::vector<StubDevice *> devices;
+StubDevice *lastStarted = 0;
+
+unsigned char hwVerFromName(const std::string &name)
+{
+    if (name == "RSP1")   return SDRPLAY_RSP1_ID;
+    if (name == "RSP1A")  return SDRPLAY_RSP1A_ID;
+    if (name == "RSP2")   return SDRPLAY_RSP2_ID;
+    if (name == "RSPduo") return SDRPLAY_RSPduo_ID;
+    if (name == "RSPdx")  return SDRPLAY_RSPdx_ID;
+    return 0;
+}
+
+unsigned int envUnsigned(const char *name, unsigned int defaultValue)
+{
+    const char *value = std::getenv(name);
+    return value ? (unsigned int)std::strtoul(value, 0, 10) : defaultValue;
+}
+
+double envDouble(const char *name, double defaultValue)
+{
+    const char *value = std::getenv(name);
+    return value ? std::strtod(value, 0) : defaultValue;
+}
+
+// stubMutex held
+void configure(void)
+{
+    if (configured)
+    {
+        return;
+    }
+    configured = true;
+    const char *value = std::getenv("SDRPLAY_STUB_DEVICES");
+    if (value) config.devices = value;
+    value = std::getenv("SDRPLAY_STUB_PACING");
+    if (value)
+    {
+        std::string pacing = value;
+        config.pacing = pacing == "freerun" ? sdrplay_api_stub_FreeRun :
+                        pacing == "manual" ? sdrplay_api_stub_Manual : sdrplay_api_stub_RealTime;
+    }
+    config.blockSize = envUnsigned("SDRPLAY_STUB_BLOCK", config.blockSize);
+    config.toneHz = envDouble("SDRPLAY_STUB_TONE", config.toneHz);
+    config.amplitude = envDouble("SDRPLAY_STUB_AMPLITUDE", config.amplitude);
+    config.jitterUs = envUnsigned("SDRPLAY_STUB_JITTER_US", config.jitterUs);
+    config.gapEvery = envUnsigned("SDRPLAY_STUB_GAP_EVERY", config.gapEvery);
+    config.gapSamples = envUnsigned("SDRPLAY_STUB_GAP_SAMPLES", config.gapSamples);
+}
+
+// stubMutex held
+void createDevices(void)
+{
+    if (!devices.empty())
+    {
+        return;
+    }
+    std::string list = config.devices;
+    size_t pos = 0;
+    while (pos <= list.size() && devices.size() < SDRPLAY_MAX_DEVICES)
+    {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(pos, end - pos);
+        pos = end + 1;
+        unsigned char hwVer = hwVerFromName(name);
+        if (hwVer == 0)
+        {
+            if (!name.empty()) std::fprintf(stderr, "sdrplay_api stub: unknown device '%s'\n", name.c_str());
+            continue;
+        }
+        StubDevice *dev = new StubDevice;
+        std::memset(&dev->info, 0, sizeof(dev->info));
+        std::snprintf(dev->info.SerNo, sizeof(dev->info.SerNo), "STUB%04u", (unsigned int)devices.size());
+        dev->info.hwVer = hwVer;
+        dev->info.tuner = hwVer == SDRPLAY_RSPduo_ID ? sdrplay_api_Tuner_Both : sdrplay_api_Tuner_A;
+        dev->info.rspDuoMode = hwVer == SDRPLAY_RSPduo_ID ?
+            (sdrplay_api_RspDuoModeT)(sdrplay_api_RspDuoMode_Single_Tuner | sdrplay_api_RspDuoMode_Dual_Tuner | sdrplay_api_RspDuoMode_Master) :
+            sdrplay_api_RspDuoMode_Unknown;
+        dev->info.rspDuoSampleFreq = 0.0;
+        dev->info.dev = dev;
+        devices.push_back(dev);
+    }
+}
+
+StubDevice *findDevice(HANDLE dev)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    for (StubDevice *d : devices)
+    {
+        if (d == dev && d->selected) return d;
+    }
+    return 0;
+}
+
+void defaultChannelParams(sdrplay_api_RxChannelParamsT &ch)
+{
+    std::memset(&ch, 0, sizeof(ch));
+    ch.tunerParams.bwType = sdrplay_api_BW_0_200;
+    ch.tunerParams.ifType = sdrplay_api_IF_Zero;
+    ch.tunerParams.gain.gRdB = 50;
+    ch.tunerParams.gain.LNAstate = 0;
+    ch.tunerParams.gain.minGr = 20;
+    ch.tunerParams.gain.gainVals.curr = 50.0f;
+    ch.tunerParams.rfFreq.rfHz = 200000000.0;
+    ch.ctrlParams.decimation.decimationFactor = 1;
+    ch.ctrlParams.agc.enable = sdrplay_api_AGC_50HZ;
+    ch.ctrlParams.agc.setPoint_dBfs = -60;
+}
+
+double outputRate(StubDevice *dev)
+{
+    const sdrplay_api_DecimationT &decimation = dev->rxA.ctrlParams.decimation;
+    double rate = dev->devParams.fsFreq.fsHz;
+    if (decimation.enable && decimation.decimationFactor > 1)
+    {
+        rate /= decimation.decimationFactor;
+    }
+    return rate > 0.0 ? rate : 2000000.0;
+}
+
+void fillTone(StubDevice *dev, short *xi, short *xq, unsigned int numSamples, double startPhase, double step)
+{
+    double amplitude = config.amplitude * 32767.0;
+    double re = std::cos(startPhase), im = std::sin(startPhase);
+    double stepRe = std::cos(step), stepIm = std::sin(step);
+    for (unsigned int i = 0; i < numSamples; i++)
+    {
+        xi[i] = (short)std::lrint(amplitude * re);
+        xq[i] = (short)std::lrint(amplitude * im);
+        double nextRe = re * stepRe - im * stepIm;
+        im = re * stepIm + im * stepRe;
+        re = nextRe;
+    }
+}
+
+// delivers one block to the callbacks; called by the stream thread, or
+// by sdrplay_api_stub_Step under stepMutex in manual pacing
+void deliverBlock(StubDevice *dev)
+{
+    unsigned int numSamples = std::min<unsigned int>(std::max<unsigned int>(config.blockSize, 1), STUB_MAX_BLOCK);
+    double rate = dev->sampleRate;
+    double step = STUB_TWO_PI * config.toneHz / rate;
+
+    // a gap: the samples are lost but the tone carries on
+    unsigned int gapEvery = config.gapEvery;
+    if (gapEvery != 0 && dev->blockNum != 0 && dev->blockNum % gapEvery == 0)
+    {
+        unsigned int gap = config.gapSamples;
+        dev->sampleNum += gap;
+        dev->phase = std::fmod(dev->phase + step * gap, STUB_TWO_PI);
+        dev->deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(gap / rate));
+        stats.gaps++;
+    }
+
+    sdrplay_api_EventParamsT eventParams;
+    int gr = dev->pendingGrA.exchange(-1);
+    if (gr >= 0 && dev->callbacks.EventCbFn)
+    {
+        std::memset(&eventParams, 0, sizeof(eventParams));
+        eventParams.gainParams.gRdB = gr;
+        eventParams.gainParams.currGain = gr;
+        dev->callbacks.EventCbFn(sdrplay_api_GainChange, sdrplay_api_Tuner_A, &eventParams, dev->cbContext);
+    }
+    gr = dev->pendingGrB.exchange(-1);
+    if (gr >= 0 && dev->callbacks.EventCbFn)
+    {
+        std::memset(&eventParams, 0, sizeof(eventParams));
+        eventParams.gainParams.gRdB = gr;
+        eventParams.gainParams.currGain = gr;
+        dev->callbacks.EventCbFn(sdrplay_api_GainChange, sdrplay_api_Tuner_B, &eventParams, dev->cbContext);
+    }
+
+    int changes = dev->pendingChanges.exchange(0);
+    sdrplay_api_StreamCbParamsT params;
+    std::memset(&params, 0, sizeof(params));
+    params.firstSampleNum = dev->sampleNum;
+    params.numSamples = numSamples;
+    params.grChanged = (changes & PENDING_GR) ? 1 : 0;
+    params.rfChanged = (changes & PENDING_RF) ? 1 : 0;
+    params.fsChanged = (changes & PENDING_FS) ? 1 : 0;
+    unsigned int reset = dev->first ? 1 : 0;
+    dev->first = false;
+
+    fillTone(dev, dev->xiA.data(), dev->xqA.data(), numSamples, dev->phase, step);
+    if (dev->rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner)
+    {
+        // tuner B sees the tone at the opposite offset
+        fillTone(dev, dev->xiB.data(), dev->xqB.data(), numSamples, -dev->phase, -step);
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (dev->callbacks.StreamACbFn)
+    {
+        dev->callbacks.StreamACbFn(dev->xiA.data(), dev->xqA.data(), &params, numSamples, reset, dev->cbContext);
+    }
+    if (dev->rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner && dev->callbacks.StreamBCbFn)
+    {
+        dev->callbacks.StreamBCbFn(dev->xiB.data(), dev->xqB.data(), &params, numSamples, reset, dev->cbContext);
+    }
+    unsigned long long callbackNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    stats.callbackNs += callbackNs;
+    unsigned long long maxNs = stats.callbackNsMax;
+    while (callbackNs > maxNs && !stats.callbackNsMax.compare_exchange_weak(maxNs, callbackNs)) {}
+
+    dev->phase = std::fmod(dev->phase + step * numSamples, STUB_TWO_PI);
+    dev->sampleNum += numSamples;
+    dev->blockNum++;
+    dev->deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(numSamples / rate));
+    stats.blocks++;
+    stats.samples += numSamples;
+}
+
+void streamThread(StubDevice *dev)
+{
+    std::mt19937 random(12345);
+    dev->deadline = std::chrono::steady_clock::now();
+    while (dev->running)
+    {
+        if (config.pacing == sdrplay_api_stub_RealTime)
+        {
+            // jitter delays this block only, the deadlines stay on time
+            std::chrono::steady_clock::time_point wakeup = dev->deadline;
+            unsigned int jitterUs = config.jitterUs;
+            if (jitterUs != 0)
+            {
+                wakeup += std::chrono::microseconds(random() % (jitterUs + 1));
+            }
+            std::this_thread::sleep_until(wakeup);
+        }
+        deliverBlock(dev);
+    }
+}
+
+// takes a snapshot of the rate and the frequencies; stubMutex not held,
+// called by the application thread that owns the parameters
+void snapshot(StubDevice *dev)
+{
+    dev->sampleRate = outputRate(dev);
+    dev->rfHzA = dev->rxA.tunerParams.rfFreq.rfHz;
+    dev->rfHzB = dev->rxB.tunerParams.rfFreq.rfHz;
+}
+
+} // namespace
+
+extern "C" {
+
+sdrplay_api_ErrT sdrplay_api_Open(void)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    configure();
+    createDevices();
+    openCount++;
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_Close(void)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    if (openCount == 0)
+    {
+        return sdrplay_api_Fail;
+    }
+    openCount--;
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_ApiVersion(float *apiVer)
+{
+    *apiVer = SDRPLAY_API_VERSION;
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_LockDeviceApi(void)
+{
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_UnlockDeviceApi(void)
+{
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_DisableHeartbeat(void)
+{
+    return sdrplay_api_Success;
+}
+
+// selected devices are not listed, as with the service
+sdrplay_api_ErrT sdrplay_api_GetDevices(sdrplay_api_DeviceT *devs, unsigned int *numDevs, unsigned int maxDevs)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    if (openCount == 0)
+    {
+        return sdrplay_api_ServiceNotResponding;
+    }
+    *numDevs = 0;
+    for (StubDevice *dev : devices)
+    {
+        if (!dev->selected && *numDevs < maxDevs)
+        {
+            devs[(*numDevs)++] = dev->info;
+        }
+    }
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_SelectDevice(sdrplay_api_DeviceT *device)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    StubDevice *dev = 0;
+    for (StubDevice *d : devices)
+    {
+        if (std::strcmp(d->info.SerNo, device->SerNo) == 0) dev = d;
+    }
+    if (!dev || dev->selected)
+    {
+        return sdrplay_api_Fail;
+    }
+    if (dev->info.hwVer == SDRPLAY_RSPduo_ID)
+    {
+        // master/slave operation across two sessions is not simulated
+        if (device->rspDuoMode != sdrplay_api_RspDuoMode_Single_Tuner &&
+            device->rspDuoMode != sdrplay_api_RspDuoMode_Dual_Tuner &&
+            device->rspDuoMode != sdrplay_api_RspDuoMode_Master)
+        {
+            return sdrplay_api_InvalidParam;
+        }
+        dev->rspDuoMode = device->rspDuoMode;
+        dev->tuner = device->rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner ? sdrplay_api_Tuner_Both : device->tuner;
+    }
+    else
+    {
+        dev->rspDuoMode = sdrplay_api_RspDuoMode_Unknown;
+        dev->tuner = sdrplay_api_Tuner_A;
+    }
+
+    std::memset(&dev->devParams, 0, sizeof(dev->devParams));
+    dev->devParams.fsFreq.fsHz = 2000000.0;
+    defaultChannelParams(dev->rxA);
+    defaultChannelParams(dev->rxB);
+    dev->params.devParams = &dev->devParams;
+    dev->params.rxChannelA = &dev->rxA;
+    dev->params.rxChannelB = dev->info.hwVer == SDRPLAY_RSPduo_ID ? &dev->rxB : 0;
+
+    dev->selected = true;
+    device->dev = dev;
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_ReleaseDevice(sdrplay_api_DeviceT *device)
+{
+    StubDevice *dev = findDevice(device->dev);
+    if (!dev)
+    {
+        return sdrplay_api_InvalidParam;
+    }
+    sdrplay_api_Uninit(dev);
+    std::lock_guard<std::mutex> lock(stubMutex);
+    dev->selected = false;
+    return sdrplay_api_Success;
+}
+
+const char *sdrplay_api_GetErrorString(sdrplay_api_ErrT err)
+{
+    switch (err)
+    {
+    case sdrplay_api_Success:                return "sdrplay_api_Success";
+    case sdrplay_api_Fail:                   return "sdrplay_api_Fail";
+    case sdrplay_api_InvalidParam:           return "sdrplay_api_InvalidParam";
+    case sdrplay_api_AlreadyInitialised:     return "sdrplay_api_AlreadyInitialised";
+    case sdrplay_api_NotInitialised:         return "sdrplay_api_NotInitialised";
+    case sdrplay_api_ServiceNotResponding:   return "sdrplay_api_ServiceNotResponding";
+    default:                                 return "sdrplay_api_Fail (stub)";
+    }
+}
+
+sdrplay_api_ErrT sdrplay_api_DebugEnable(HANDLE dev, sdrplay_api_DbgLvl_t enable)
+{
+    return findDevice(dev) ? sdrplay_api_Success : sdrplay_api_InvalidParam;
+}
+
+sdrplay_api_ErrT sdrplay_api_GetDeviceParams(HANDLE dev, sdrplay_api_DeviceParamsT **deviceParams)
+{
+    StubDevice *d = findDevice(dev);
+    if (!d)
+    {
+        return sdrplay_api_InvalidParam;
+    }
+    *deviceParams = &d->params;
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_Init(HANDLE dev, sdrplay_api_CallbackFnsT *callbackFns, void *cbContext)
+{
+    StubDevice *d = findDevice(dev);
+    if (!d)
+    {
+        return sdrplay_api_InvalidParam;
+    }
+    std::lock_guard<std::recursive_mutex> step(d->stepMutex);
+    if (d->initialised)
+    {
+        return sdrplay_api_AlreadyInitialised;
+    }
+    d->callbacks = *callbackFns;
+    d->cbContext = cbContext;
+    snapshot(d);
+    d->pendingChanges = 0;
+    d->pendingGrA = -1;
+    d->pendingGrB = -1;
+    d->sampleNum = 0;
+    d->blockNum = 0;
+    d->phase = 0.0;
+    d->first = true;
+    d->deadline = std::chrono::steady_clock::now();
+    d->xiA.assign(STUB_MAX_BLOCK, 0);
+    d->xqA.assign(STUB_MAX_BLOCK, 0);
+    d->xiB.assign(STUB_MAX_BLOCK, 0);
+    d->xqB.assign(STUB_MAX_BLOCK, 0);
+    d->initialised = true;
+    stats.inits++;
+    if (config.pacing != sdrplay_api_stub_Manual)
+    {
+        d->running = true;
+        d->thread = std::thread(streamThread, d);
+    }
+    std::lock_guard<std::mutex> lock(stubMutex);
+    lastStarted = d;
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_Uninit(HANDLE dev)
+{
+    StubDevice *d = findDevice(dev);
+    if (!d)
+    {
+        return sdrplay_api_InvalidParam;
+    }
+    d->running = false;
+    if (d->thread.joinable())
+    {
+        d->thread.join();
+    }
+    std::lock_guard<std::recursive_mutex> step(d->stepMutex);
+    if (!d->initialised)
+    {
+        return sdrplay_api_NotInitialised;
+    }
+    d->initialised = false;
+    std::lock_guard<std::mutex> lock(stubMutex);
+    if (lastStarted == d)
+    {
+        lastStarted = 0;
+    }
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_Update(HANDLE dev, sdrplay_api_TunerSelectT tuner,
+                                    sdrplay_api_ReasonForUpdateT reasonForUpdate,
+                                    sdrplay_api_ReasonForUpdateExtension1T reasonForUpdateExt1)
+{
+    StubDevice *d = findDevice(dev);
+    if (!d)
+    {
+        return sdrplay_api_InvalidParam;
+    }
+    stats.updates++;
+    std::lock_guard<std::recursive_mutex> step(d->stepMutex);
+    if (!d->initialised)
+    {
+        return sdrplay_api_NotInitialised;
+    }
+    snapshot(d);
+    int changes = 0;
+    if (reasonForUpdate & sdrplay_api_Update_Tuner_Gr)
+    {
+        // the gain lands as requested; AGC is not simulated
+        if (tuner != sdrplay_api_Tuner_B)
+        {
+            d->rxA.tunerParams.gain.gainVals.curr = (float)d->rxA.tunerParams.gain.gRdB;
+            d->pendingGrA = d->rxA.tunerParams.gain.gRdB;
+        }
+        if (tuner == sdrplay_api_Tuner_B || tuner == sdrplay_api_Tuner_Both)
+        {
+            d->rxB.tunerParams.gain.gainVals.curr = (float)d->rxB.tunerParams.gain.gRdB;
+            d->pendingGrB = d->rxB.tunerParams.gain.gRdB;
+        }
+        changes |= PENDING_GR;
+    }
+    if (reasonForUpdate & sdrplay_api_Update_Tuner_Frf)
+    {
+        changes |= PENDING_RF;
+    }
+    if (reasonForUpdate & (sdrplay_api_Update_Dev_Fs | sdrplay_api_Update_Ctrl_Decimation))
+    {
+        changes |= PENDING_FS;
+    }
+    d->pendingChanges |= changes;
+    return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_SwapRspDuoActiveTuner(HANDLE dev, sdrplay_api_TunerSelectT *currentTuner,
+                                                   sdrplay_api_RspDuo_AmPortSelectT tuner1AmPortSel)
+{
+    StubDevice *d = findDevice(dev);
+    if (!d || d->info.hwVer != SDRPLAY_RSPduo_ID || d->rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner)
+    {
+        return sdrplay_api_InvalidParam;
+    }
+    std::lock_guard<std::recursive_mutex> step(d->stepMutex);
+    d->tuner = d->tuner == sdrplay_api_Tuner_A ? sdrplay_api_Tuner_B : sdrplay_api_Tuner_A;
+    *currentTuner = d->tuner;
+    return sdrplay_api_Success;
+}
+
+#if defined(__arm__) || defined(__aarch64__)
+sdrplay_api_ErrT sdrplay_api_SetTransferMode(sdrplay_api_TransferModeT mode)
+{
+    return sdrplay_api_Success;
+}
+#endif
+
+/*******************************************************************
+ * Simulation controls
+ ******************************************************************/
+
+void sdrplay_api_stub_SetDevices(const char *list)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    configure();
+    if (!devices.empty())
+    {
+        std::fprintf(stderr, "sdrplay_api stub: the devices are already listed\n");
+        return;
+    }
+    config.devices = list;
+}
+
+void sdrplay_api_stub_SetPacing(sdrplay_api_stub_PacingT pacing)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    configure();
+    config.pacing = pacing;
+}
+
+void sdrplay_api_stub_SetBlockSize(unsigned int numSamples)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    configure();
+    config.blockSize = numSamples;
+}
+
+void sdrplay_api_stub_SetTone(double offsetHz, double amplitude)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    configure();
+    config.toneHz = offsetHz;
+    config.amplitude = amplitude;
+}
+
+void sdrplay_api_stub_SetJitter(unsigned int maxJitterUs)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    configure();
+    config.jitterUs = maxJitterUs;
+}
+
+void sdrplay_api_stub_SetGaps(unsigned int everyBlocks, unsigned int gapSamples)
+{
+    std::lock_guard<std::mutex> lock(stubMutex);
+    configure();
+    config.gapEvery = everyBlocks;
+    config.gapSamples = gapSamples;
+}
+
+unsigned int sdrplay_api_stub_Step(unsigned int numBlocks)
+{
+    StubDevice *dev;
+    {
+        std::lock_guard<std::mutex> lock(stubMutex);
+        dev = lastStarted;
+    }
+    if (!dev || dev->running)
+    {
+        return 0;
+    }
+    std::lock_guard<std::recursive_mutex> step(dev->stepMutex);
+    if (!dev->initialised)
+    {
+        return 0;
+    }
+    for (unsigned int i = 0; i < numBlocks; i++)
+    {
+        deliverBlock(dev);
+    }
+    return numBlocks;
+}
+
+void sdrplay_api_stub_GetStats(sdrplay_api_stub_StatsT *out)
+{
+    out->blocks = stats.blocks;
+    out->samples = stats.samples;
+    out->gaps = stats.gaps;
+    out->updates = stats.updates;
+    out->inits = stats.inits;
+    out->callbackNs = stats.callbackNs;
+    out->callbackNsMax = stats.callbackNsMax;
+}
+
+void sdrplay_api_stub_ResetStats(void)
+{
+    stats.blocks = 0;
+    stats.samples = 0;
+    stats.gaps = 0;
+    stats.updates = 0;
+    stats.inits = 0;
+    stats.callbackNs = 0;
+    stats.callbackNsMax = 0;
+}
+
+} // extern "C"
@@ -0,0 +1,97 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*******************************************************************
+ * Controls of the stub sdrplay_api
+ *
+ * The stub implements the sdrplay_api entry points used by the module
+ * and simulates the devices: after sdrplay_api_Init a thread calls the
+ * stream callbacks with a synthetic tone at fsHz / decimationFactor.
+ * These calls (or the SDRPLAY_STUB_* environment variables, read by the
+ * first sdrplay_api_Open) control the simulation; they apply to all the
+ * devices and take effect on the next block.
+ ******************************************************************/
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    sdrplay_api_stub_RealTime = 0,  // blocks at the sample rate (SDRPLAY_STUB_PACING=realtime)
+    sdrplay_api_stub_FreeRun  = 1,  // blocks as fast as possible (SDRPLAY_STUB_PACING=freerun)
+    sdrplay_api_stub_Manual   = 2,  // no thread: blocks by sdrplay_api_stub_Step (SDRPLAY_STUB_PACING=manual)
+} sdrplay_api_stub_PacingT;
+
+typedef struct
+{
+    unsigned long long blocks;      // stream callbacks on tuner A
+    unsigned long long samples;     // samples delivered on tuner A
+    unsigned long long gaps;        // gaps inserted
+    unsigned long long updates;     // sdrplay_api_Update calls
+    unsigned long long inits;       // sdrplay_api_Init calls
+    unsigned long long callbackNs;  // time spent in the stream callbacks
+    unsigned long long callbackNsMax; // longest stream callback
+} sdrplay_api_stub_StatsT;
+
+// the devices listed by sdrplay_api_GetDevices, e.g. "RSP1A,RSPduo"
+// (RSP1, RSP1A, RSP2, RSPduo, RSPdx); call before sdrplay_api_Open
+// (SDRPLAY_STUB_DEVICES, default "RSP1A,RSPduo")
+void sdrplay_api_stub_SetDevices(const char *devices);
+
+void sdrplay_api_stub_SetPacing(sdrplay_api_stub_PacingT pacing);
+
+// samples per stream callback (SDRPLAY_STUB_BLOCK, default 1008)
+void sdrplay_api_stub_SetBlockSize(unsigned int numSamples);
+
+// tone offset from the tuned frequency in Hz and amplitude in full scale
+// units (SDRPLAY_STUB_TONE, default 100000, SDRPLAY_STUB_AMPLITUDE,
+// default 0.5)
+void sdrplay_api_stub_SetTone(double offsetHz, double amplitude);
+
+// each block is late by a uniformly distributed 0..maxJitterUs, without
+// changing the average rate (SDRPLAY_STUB_JITTER_US, default 0)
+void sdrplay_api_stub_SetJitter(unsigned int maxJitterUs);
+
+// every 'everyBlocks' blocks, gapSamples samples are skipped: the sample
+// number jumps as after a lost USB transfer (SDRPLAY_STUB_GAP_EVERY and
+// SDRPLAY_STUB_GAP_SAMPLES, default 0 = no gaps)
+void sdrplay_api_stub_SetGaps(unsigned int everyBlocks, unsigned int gapSamples);
+
+// manual pacing: delivers numBlocks blocks from the calling thread to
+// the device started last; returns the number delivered
+unsigned int sdrplay_api_stub_Step(unsigned int numBlocks);
+
+void sdrplay_api_stub_GetStats(sdrplay_api_stub_StatsT *stats);
+
+void sdrplay_api_stub_ResetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,243 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*******************************************************************
+ * sdrplay3_bench: streaming hot path benchmark
+ *
+ * Drives rx_callback with synthetic blocks and drains the fifo with
+ * readStream (readChannel) or acquireReadBuffer/releaseReadBuffer in the
+ * calling thread, so that the numbers reflect the cost of the code path
+ * rather than the thread scheduling. The devices are simulated by the
+ * stub sdrplay_api in manual pacing, so nothing else calls rx_callback.
+ *
+ * usage: sdrplay3_bench [samples per case]; prints the results as JSON
+ ******************************************************************/
+
+#include "SoapySDRPlay3.hpp"
+#include "SdrplayApiStub.h"
+
+#include <cstdlib>
+#include <new>
+
+// every heap allocation while counting is enabled is counted
+static std::atomic_bool countAllocations(false);
+static std::atomic_ullong allocations(0);
+
+void *operator new(std::size_t size)
+{
+    if (countAllocations) allocations++;
+    void *p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+struct BenchmarkCase
+{
+    const char *format;
+    int channels;
+    unsigned int callbackSamples;
+    unsigned int decimation;
+    bool direct;
+};
+
+int main(int argc, char *argv[])
+{
+    // every case has to fill several fifo slots (of up to the MTU)
+    const size_t minSamplesPerCase = 4 * DEFAULT_BUFFER_LENGTH;
+    size_t samplesPerCase = 1 << 21;
+    if (argc > 1) samplesPerCase = std::strtoull(argv[1], 0, 10);
+    if (samplesPerCase < minSamplesPerCase)
+    {
+        fprintf(stderr, "usage: %s [samples per case, at least %zu]\n", argv[0], minSamplesPerCase);
+        return 1;
+    }
+
+    sdrplay_api_stub_SetDevices("RSP1A,RSPduo");
+    sdrplay_api_stub_SetPacing(sdrplay_api_stub_Manual);
+    SoapySDR_setLogLevel(SOAPY_SDR_WARNING);
+
+    SoapySDR::Kwargs args;
+    args["serial"] = "STUB0000";
+    SoapySDRPlay3 single(args);
+    args["serial"] = "STUB0001";
+    args["rspduo_mode"] = "Dual Tuner";
+    SoapySDRPlay3 dual(args);
+
+    // synthetic noise-like input, so the conversion and statistics loops
+    // see realistic data
+    const unsigned int maxCallbackSamples = 4032;
+    std::vector<short> xi(maxCallbackSamples);
+    std::vector<short> xq(maxCallbackSamples);
+    uint32_t lcg = 12345;
+    for (unsigned int i = 0; i < maxCallbackSamples; i++)
+    {
+        lcg = lcg * 1664525 + 1013904223;
+        xi[i] = (short)((int)(lcg >> 16) % 4096 - 2048);
+        lcg = lcg * 1664525 + 1013904223;
+        xq[i] = (short)((int)(lcg >> 16) % 4096 - 2048);
+    }
+
+    std::vector<BenchmarkCase> cases;
+    const unsigned int callbackSizes[] = { 252, 1008, 4032 };
+    const unsigned int decimations[] = { 1, 4, 32 };
+    for (const char *format : { "CS16", "CF32" })
+    {
+        for (int channels : { 1, 2 })
+        {
+            for (unsigned int callbackSamples : callbackSizes)
+            {
+                for (unsigned int decimation : decimations)
+                {
+                    cases.push_back({ format, channels, callbackSamples, decimation, false });
+                    cases.push_back({ format, channels, callbackSamples, decimation, true });
+                }
+            }
+        }
+    }
+
+    printf("{\"samples_per_case\":%zu,\"results\":[", samplesPerCase);
+    bool ok = true;
+    for (size_t c = 0; c < cases.size(); c++)
+    {
+        const BenchmarkCase &bc = cases[c];
+        SoapySDRPlay3 &dev = (bc.channels > 1) ? dual : single;
+        std::vector<size_t> channels = (bc.channels > 1) ? std::vector<size_t>{ 0, 1 } : std::vector<size_t>{ 0 };
+        SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, bc.format, channels);
+        dev.setSampleRate(SOAPY_SDR_RX, 0, 2e6 / bc.decimation);
+        dev.activateStream(stream);
+
+        size_t mtu = dev.getStreamMTU(stream);
+        std::vector<float> outA(mtu * 2), outB(mtu * 2);
+        void *outs[2] = { outA.data(), outB.data() };
+        int flags = 0;
+        long long timeNs = 0;
+
+        // empties the fifo; returns the samples read per channel
+        auto drain = [&]() -> size_t
+        {
+            size_t n = 0;
+            for (;;)
+            {
+                int ret;
+                if (bc.direct)
+                {
+                    size_t handle;
+                    const void *buffs[2];
+                    ret = dev.acquireReadBuffer(stream, handle, buffs, flags, timeNs, 0);
+                    if (ret >= 0) dev.releaseReadBuffer(stream, handle);
+                }
+                else
+                {
+                    ret = dev.readStream(stream, outs, mtu, flags, timeNs, 0);
+                }
+                if (ret <= 0) return n;
+                n += ret;
+            }
+        };
+
+        // the reset left by activateStream would flush the first blocks
+        drain();
+
+        sdrplay_api_StreamCbParamsT params;
+        std::memset(&params, 0, sizeof(params));
+        std::chrono::steady_clock::duration callbackTime(0);
+        std::chrono::steady_clock::duration consumerTime(0);
+        size_t produced = 0;
+        size_t samplesRead = 0;
+        size_t samplesTimed = 0;
+        unsigned long long callbacks = 0;
+
+        // the first blocks fill the fifo slots up to their working size
+        size_t warmup = 16 * bc.callbackSamples;
+        allocations = 0;
+        while (produced < warmup + samplesPerCase)
+        {
+            countAllocations = produced >= warmup;
+            auto t0 = std::chrono::steady_clock::now();
+            dev.rx_callback(xi.data(), xq.data(), &params, bc.callbackSamples, 0, sdrplay_api_Tuner_A);
+            if (bc.channels > 1)
+            {
+                dev.rx_callback(xi.data(), xq.data(), &params, bc.callbackSamples, 0, sdrplay_api_Tuner_B);
+            }
+            params.firstSampleNum += bc.callbackSamples;
+            produced += bc.callbackSamples;
+
+            auto t1 = std::chrono::steady_clock::now();
+            size_t n = drain();
+            auto t2 = std::chrono::steady_clock::now();
+            samplesRead += n;
+            if (countAllocations)
+            {
+                samplesTimed += n;
+                callbackTime += t1 - t0;
+                consumerTime += t2 - t1;
+                callbacks++;
+            }
+        }
+        countAllocations = false;
+
+        // a block flagged with a change publishes the slot that was still
+        // filling; the block itself stays behind in the next slot
+        params.rfChanged = 1;
+        dev.rx_callback(xi.data(), xq.data(), &params, bc.callbackSamples, 0, sdrplay_api_Tuner_A);
+        if (bc.channels > 1)
+        {
+            dev.rx_callback(xi.data(), xq.data(), &params, bc.callbackSamples, 0, sdrplay_api_Tuner_B);
+        }
+        samplesRead += drain();
+
+        dev.deactivateStream(stream);
+        dev.closeStream(stream);
+
+        // every sample delivered must come out
+        if (samplesRead != produced)
+        {
+            fprintf(stderr, "case %zu: %zu of %zu samples read\n", c, samplesRead, produced);
+            ok = false;
+        }
+
+        double callbackNs = std::chrono::duration<double, std::nano>(callbackTime).count();
+        double consumerNs = std::chrono::duration<double, std::nano>(consumerTime).count();
+        double totalSamples = (double)samplesTimed * bc.channels;
+        printf("%s\n{\"format\":\"%s\",\"channels\":%d,\"callback_samples\":%u,\"decimation\":%u,\"consumer\":\"%s\","
+               "\"samples_read\":%zu,\"samples_per_sec\":%.6g,\"ns_per_sample\":%.6g,"
+               "\"callback_ns_per_sample\":%.6g,\"consumer_ns_per_sample\":%.6g,"
+               "\"allocations\":%llu,\"allocations_per_callback\":%.6g}",
+               c ? "," : "", bc.format, bc.channels, bc.callbackSamples, bc.decimation,
+               bc.direct ? "acquireReadBuffer" : "readChannel", samplesRead,
+               totalSamples * 1e9 / (callbackNs + consumerNs), (callbackNs + consumerNs) / totalSamples,
+               callbackNs / totalSamples, consumerNs / totalSamples,
+               allocations.load(), (double)allocations / callbacks);
+    }
+    printf("\n]}\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*******************************************************************
+ * sdrplay3_rate_plan_test: sample rate planner
+ *
+ * Sets every listed sample rate in every IF mode and checks the plan
+ * reported by the rate_plan setting: the ADC rate (the USB rate) must
+ * deliver the rate exactly, within the ADC range of the IF mode and as
+ * low as the hardware decimation allows; a listed rate without a plan
+ * is a failure. Then widens the IF filter past the ADC rate and checks
+ * that the plan moves to an ADC rate that covers it.
+ ******************************************************************/
+
+#include "SoapySDRPlay3.hpp"
+#include "SdrplayApiStub.h"
+
+#include <cstdio>
+
+struct LowIfPlan
+{
+    const char *ifMode;
+    unsigned long rate;
+    unsigned long fs;
+    unsigned int decimation;
+};
+
+// the low IF modes tie the ADC rate to the IF
+static const LowIfPlan lowIfPlans[] = {
+    { "450kHz",   1000000, 2000000, 2 },
+    { "450kHz",    500000, 2000000, 4 },
+    { "1620kHz",  1500000, 6000000, 4 },
+    { "1620kHz",   750000, 6000000, 8 },
+    { "2048kHz",  2048000, 8192000, 4 },
+};
+
+struct BandwidthPlan
+{
+    unsigned long rate;
+    double bandwidth;
+    unsigned long fs;
+    unsigned int decimation;
+};
+
+// Zero-IF: the lowest ADC rate that covers the filter
+static const BandwidthPlan bandwidthPlans[] = {
+    {  250000, 1536000, 2000000, 8 },
+    { 1000000, 5000000, 8000000, 8 },
+    { 2000000, 5000000, 8000000, 4 },
+    { 3000000, 5000000, 6000000, 2 },
+};
+
+static bool parsePlan(const std::string &plan, unsigned long &fs, unsigned int &decimation, unsigned long &rate, unsigned long &bandwidth)
+{
+    return sscanf(plan.c_str(), "fs=%lu,decimation=%u,rate=%lu,bandwidth=%lu", &fs, &decimation, &rate, &bandwidth) == 4;
+}
+
+int main(int argc, char *argv[])
+{
+    sdrplay_api_stub_SetDevices("RSP1A");
+    SoapySDR_setLogLevel(SOAPY_SDR_ERROR);
+
+    SoapySDR::Kwargs args;
+    args["serial"] = "STUB0000";
+    SoapySDRPlay3 dev(args);
+
+    int failures = 0;
+    int checked = 0;
+    for (const char *ifMode : { "Zero-IF", "450kHz", "1620kHz", "2048kHz" })
+    {
+        dev.writeSetting("if_mode", ifMode);
+        std::vector<double> rates = dev.listSampleRates(SOAPY_SDR_RX, 0);
+
+        // every low IF rate must be offered
+        for (const LowIfPlan &p : lowIfPlans)
+        {
+            if (p.ifMode == std::string(ifMode) && std::find(rates.begin(), rates.end(), (double)p.rate) == rates.end())
+            {
+                fprintf(stderr, "%s: %lu is not listed\n", ifMode, p.rate);
+                failures++;
+            }
+        }
+
+        for (double rate : rates)
+        {
+            dev.setSampleRate(SOAPY_SDR_RX, 0, rate);
+            std::string plan = dev.readSetting("rate_plan");
+            unsigned long fs = 0, planRate = 0, bandwidth = 0;
+            unsigned int decimation = 0;
+            if (!parsePlan(plan, fs, decimation, planRate, bandwidth))
+            {
+                fprintf(stderr, "%s %.0f: can't parse '%s'\n", ifMode, rate, plan.c_str());
+                failures++;
+                continue;
+            }
+
+            // the expected plan
+            bool planned = false;
+            unsigned long expectFs = 0;
+            unsigned int expectDecimation = 0;
+            if (std::string(ifMode) == "Zero-IF")
+            {
+                // the lowest ADC rate from 2 MS/s on, with a decimation
+                // factor of up to 32
+                expectFs = (unsigned long)rate;
+                expectDecimation = 1;
+                while (expectFs < 2000000 && expectDecimation < 32)
+                {
+                    expectFs *= 2;
+                    expectDecimation *= 2;
+                }
+                planned = expectFs >= 2000000 && expectFs <= 10660000;
+            }
+            for (const LowIfPlan &p : lowIfPlans)
+            {
+                if (p.ifMode == std::string(ifMode) && p.rate == (unsigned long)rate)
+                {
+                    expectFs = p.fs;
+                    expectDecimation = p.decimation;
+                    planned = true;
+                }
+            }
+
+            checked++;
+            if (!planned)
+            {
+                fprintf(stderr, "%s %.0f: listed, but there is no plan for it\n", ifMode, rate);
+                failures++;
+            }
+            else if (fs != expectFs || decimation != expectDecimation || planRate != (unsigned long)rate ||
+                     fs != planRate * decimation || bandwidth > fs)
+            {
+                fprintf(stderr, "%s %.0f: got '%s', expected fs=%lu,decimation=%u\n",
+                        ifMode, rate, plan.c_str(), expectFs, expectDecimation);
+                failures++;
+            }
+        }
+    }
+
+    dev.writeSetting("if_mode", "Zero-IF");
+    for (const BandwidthPlan &p : bandwidthPlans)
+    {
+        dev.setSampleRate(SOAPY_SDR_RX, 0, (double)p.rate);
+        dev.setBandwidth(SOAPY_SDR_RX, 0, p.bandwidth);
+        std::string plan = dev.readSetting("rate_plan");
+        unsigned long fs = 0, planRate = 0, bandwidth = 0;
+        unsigned int decimation = 0;
+        checked++;
+        if (!parsePlan(plan, fs, decimation, planRate, bandwidth) || fs != p.fs || decimation != p.decimation ||
+            planRate != p.rate || bandwidth != (unsigned long)p.bandwidth)
+        {
+            fprintf(stderr, "%lu with %.0f Hz bandwidth: got '%s', expected fs=%lu,decimation=%u\n",
+                    p.rate, p.bandwidth, plan.c_str(), p.fs, p.decimation);
+            failures++;
+        }
+    }
+
+    printf("%d rate plans checked, %d failed\n", checked, failures);
+    return failures == 0 ? 0 : 1;
+}
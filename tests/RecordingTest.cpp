@@ -0,0 +1,117 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*******************************************************************
+ * sdrplay3_recording_test: bit exact recording round trip
+ *
+ * Records a simulated stream (with gaps in the sample numbers) while
+ * the history ring keeps a raw copy, then decodes every block of the
+ * recording and compares it with the history.
+ ******************************************************************/
+
+#include "SoapySDRPlay3.hpp"
+#include "SdrplayApiStub.h"
+
+#include <cstdio>
+
+static bool roundTrip(SoapySDRPlay3 &dev, const std::string &path, double toneHz, double amplitude)
+{
+    sdrplay_api_stub_SetTone(toneHz, amplitude);
+    sdrplay_api_stub_ResetStats();
+
+    SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, "CS16", std::vector<size_t>{ 0 });
+    dev.activateStream(stream);
+    dev.writeSetting("record_file", path);
+    sdrplay_api_stub_Step(400);
+    dev.writeSetting("record_file", "");
+    dev.deactivateStream(stream);
+    dev.closeStream(stream);
+
+    sdrplay_api_stub_StatsT stats;
+    sdrplay_api_stub_GetStats(&stats);
+
+    std::vector<SoapySDRPlay3::RecordingBlock> index;
+    if (!SoapySDRPlay3::readRecordingIndex(path, index))
+    {
+        fprintf(stderr, "%s: can't read the index\n", path.c_str());
+        return false;
+    }
+
+    unsigned long long recorded = 0;
+    std::vector<short> samples, history;
+    for (const auto &block : index)
+    {
+        if (!SoapySDRPlay3::readRecordingBlock(path, block, samples))
+        {
+            fprintf(stderr, "%s: can't decode the block at %llu\n", path.c_str(), block.offset);
+            return false;
+        }
+        history.resize(block.numSamples * 2);
+        unsigned long long first = block.firstSampleNum;
+        size_t n = dev.readHistory(0, first, block.numSamples, history.data());
+        if (n != block.numSamples || first != block.firstSampleNum)
+        {
+            fprintf(stderr, "%s: samples %llu..%llu are not in the history\n", path.c_str(),
+                    block.firstSampleNum, block.firstSampleNum + block.numSamples);
+            return false;
+        }
+        if (samples != history)
+        {
+            fprintf(stderr, "%s: the block at sample %llu differs\n", path.c_str(), block.firstSampleNum);
+            return false;
+        }
+        recorded += block.numSamples;
+    }
+    if (recorded != stats.samples)
+    {
+        fprintf(stderr, "%s: %llu samples recorded, %llu delivered\n", path.c_str(), recorded, stats.samples);
+        return false;
+    }
+    printf("%s: %zu blocks, %llu samples, %llu gaps: ok\n", path.c_str(), index.size(), recorded, stats.gaps);
+    std::remove(path.c_str());
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    sdrplay_api_stub_SetDevices("RSP1A");
+    sdrplay_api_stub_SetPacing(sdrplay_api_stub_Manual);
+    sdrplay_api_stub_SetGaps(37, 1234);
+    SoapySDR_setLogLevel(SOAPY_SDR_WARNING);
+
+    SoapySDR::Kwargs args;
+    args["serial"] = "STUB0000";
+    SoapySDRPlay3 dev(args);
+    dev.setSampleRate(SOAPY_SDR_RX, 0, 2e6);
+    dev.writeSetting("history_seconds", "1");
+
+    // a smooth tone, and one near fs/2 at full scale for the largest
+    // differences between samples
+    bool ok = roundTrip(dev, "sdrplay3_recording_test.rec", 100e3, 0.5);
+    ok = roundTrip(dev, "sdrplay3_recording_test_fs.rec", 0.93e6, 1.0) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*******************************************************************
+ * sdrplay3_startup_bench: device discovery and open benchmark
+ *
+ * Times repeated calls of the module's find function (the full device
+ * list, as SoapySDR::Device::enumerate does) and of the constructor and
+ * destructor, once with the enumeration cache disabled (cache_ttl=0) and
+ * once with it enabled, against the stub sdrplay_api. With the real
+ * service the listing is an Open/GetDevices/Close round trip, so the
+ * stub numbers are the module's own share of the startup time.
+ *
+ * usage: sdrplay3_startup_bench [iterations]; prints the results as JSON
+ ******************************************************************/
+
+#include "SoapySDRPlay3.hpp"
+#include "SdrplayApiStub.h"
+
+#include <SoapySDR/Registry.hpp>
+
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int iterations = 200;
+    if (argc > 1) iterations = std::atoi(argv[1]);
+    if (iterations < 1)
+    {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    sdrplay_api_stub_SetDevices("RSP1A,RSPduo");
+    sdrplay_api_stub_SetPacing(sdrplay_api_stub_Manual);
+    SoapySDR_setLogLevel(SOAPY_SDR_WARNING);
+
+    SoapySDR::FindFunctions findFunctions = SoapySDR::Registry::listFindFunctions();
+    if (findFunctions.count("sdrplay3") == 0)
+    {
+        fprintf(stderr, "the sdrplay3 module is not registered\n");
+        return 1;
+    }
+    SoapySDR::FindFunction find = findFunctions.at("sdrplay3");
+
+    printf("{\"iterations\":%d,\"results\":[", iterations);
+    bool ok = true;
+    const double cacheTtls[] = { 0.0, DEFAULT_ENUM_CACHE_TTL };
+    for (size_t m = 0; m < 2; m++)
+    {
+        double cacheTtl = cacheTtls[m];
+        SoapySDR::Kwargs findArgs;
+        findArgs["cache_ttl"] = std::to_string(cacheTtl);
+        SoapySDR::Kwargs makeArgs = findArgs;
+        makeArgs["serial"] = "STUB0000";
+
+        // one untimed round, so that an enabled cache starts filled
+        if (find(findArgs).size() != 2)
+        {
+            fprintf(stderr, "cache_ttl=%g: find did not list both stub devices\n", cacheTtl);
+            ok = false;
+        }
+
+        std::chrono::steady_clock::duration findTime(0);
+        std::chrono::steady_clock::duration findMax(0);
+        std::chrono::steady_clock::duration makeTime(0);
+        std::chrono::steady_clock::duration makeMax(0);
+        for (int i = 0; i < iterations; i++)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            size_t found = find(findArgs).size();
+            auto t1 = std::chrono::steady_clock::now();
+            {
+                SoapySDRPlay3 dev(makeArgs);
+            }
+            auto t2 = std::chrono::steady_clock::now();
+
+            if (found != 2)
+            {
+                fprintf(stderr, "cache_ttl=%g: find listed %zu device(s)\n", cacheTtl, found);
+                ok = false;
+            }
+            findTime += t1 - t0;
+            findMax = std::max(findMax, t1 - t0);
+            makeTime += t2 - t1;
+            makeMax = std::max(makeMax, t2 - t1);
+        }
+
+        auto us = [](std::chrono::steady_clock::duration d) -> double
+        {
+            return std::chrono::duration<double, std::micro>(d).count();
+        };
+        printf("%s\n{\"cache\":\"%s\",\"cache_ttl\":%g,"
+               "\"find_us\":%.6g,\"find_max_us\":%.6g,"
+               "\"construct_us\":%.6g,\"construct_max_us\":%.6g}",
+               m ? "," : "", cacheTtl > 0.0 ? "on" : "off", cacheTtl,
+               us(findTime) / iterations, us(findMax),
+               us(makeTime) / iterations, us(makeMax));
+    }
+    printf("\n]}\n");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2019 Franco Venturi - changes for SDRplay API version 3
+ *                                     and Dual Tuner for RSPduo
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*******************************************************************
+ * sdrplay3_stress: settings changes while streaming
+ *
+ * Streams from a simulated RSP1A at the sample rate it is set to while
+ * one thread retunes, changes the gain, the sample rate and a setting
+ * at a fixed rate and another polls the getters, sensors and statistics
+ * as a GUI does. The throughput and the time spent in the stream
+ * callbacks are compared with a phase of streaming alone. Build with
+ * -fsanitize=thread to check for data races.
+ *
+ * usage: sdrplay3_stress [seconds per phase] [changes per second];
+ * prints the results as JSON
+ ******************************************************************/
+
+#include "SoapySDRPlay3.hpp"
+#include "SdrplayApiStub.h"
+
+#include <cstdlib>
+#include <thread>
+
+struct PhaseResult
+{
+    double seconds;
+    unsigned long long samplesRead;
+    unsigned long long overflows;
+    unsigned long long timeouts;
+    unsigned long long errors;
+    unsigned long long changes;
+    unsigned long long polls;
+    sdrplay_api_stub_StatsT stub;
+};
+
+static void runPhase(SoapySDRPlay3 &dev, SoapySDR::Stream *stream, double seconds, double changeRate, PhaseResult &result)
+{
+    std::atomic_bool running(true);
+    std::atomic_ullong changes(0);
+    std::atomic_ullong polls(0);
+    std::memset(&result, 0, sizeof(result));
+
+    std::vector<std::thread> threads;
+    if (changeRate > 0)
+    {
+        threads.emplace_back([&]()
+        {
+            const double rates[] = { 2e6, 4e6, 8e6, 500e3 };
+            auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / changeRate));
+            auto next = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; running; i++)
+            {
+                switch (i % 4)
+                {
+                case 0: dev.setFrequency(SOAPY_SDR_RX, 0, "RF", 100e6 + (i % 1000) * 1e5); break;
+                case 1: dev.setGain(SOAPY_SDR_RX, 0, "IFGR", 20 + (i % 40)); break;
+                case 2: dev.setSampleRate(SOAPY_SDR_RX, 0, rates[(i / 4) % 4]); break;
+                case 3: dev.writeSetting("rfnotch_ctrl", (i / 4) % 2 ? "true" : "false"); break;
+                }
+                changes++;
+                next += period;
+                std::this_thread::sleep_until(next);
+            }
+        });
+        threads.emplace_back([&]()
+        {
+            while (running)
+            {
+                dev.getFrequency(SOAPY_SDR_RX, 0, "RF");
+                dev.getGain(SOAPY_SDR_RX, 0, "IFGR");
+                dev.getSampleRate(SOAPY_SDR_RX, 0);
+                dev.readSensor(SOAPY_SDR_RX, 0, "power_dbfs");
+                dev.readSensor(SOAPY_SDR_RX, 0, "buffer_fill");
+                dev.readSetting("buffer_stats");
+                dev.readSetting("callback_cadence");
+                polls++;
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+    }
+
+    sdrplay_api_stub_ResetStats();
+    size_t mtu = dev.getStreamMTU(stream);
+    std::vector<short> buff(2 * mtu);
+    void *buffs[1] = { buff.data() };
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    while (std::chrono::steady_clock::now() < end)
+    {
+        int flags;
+        long long timeNs;
+        int ret = dev.readStream(stream, buffs, mtu, flags, timeNs, 100000);
+        if (ret > 0) result.samplesRead += ret;
+        else if (ret == SOAPY_SDR_OVERFLOW) result.overflows++;
+        else if (ret == SOAPY_SDR_TIMEOUT) result.timeouts++;
+        else result.errors++;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sdrplay_api_stub_GetStats(&result.stub);
+
+    running = false;
+    for (auto &thread : threads) thread.join();
+    result.changes = changes;
+    result.polls = polls;
+}
+
+static void printPhase(const char *name, const PhaseResult &r, bool last)
+{
+    printf("\"%s\":{\"seconds\":%.3f,\"samples_per_sec\":%.6g,\"delivered_per_sec\":%.6g,"
+           "\"overflows\":%llu,\"timeouts\":%llu,\"errors\":%llu,"
+           "\"callbacks\":%llu,\"callback_ns_avg\":%.6g,\"callback_ns_max\":%llu,"
+           "\"updates\":%llu,\"changes_per_sec\":%.6g,\"polls_per_sec\":%.6g}%s\n",
+           name, r.seconds, r.samplesRead / r.seconds, r.stub.samples / r.seconds,
+           r.overflows, r.timeouts, r.errors,
+           r.stub.blocks, r.stub.blocks ? (double)r.stub.callbackNs / r.stub.blocks : 0.0, r.stub.callbackNsMax,
+           r.stub.updates, r.changes / r.seconds, r.polls / r.seconds, last ? "" : ",");
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = (argc > 1) ? std::strtod(argv[1], 0) : 5.0;
+    double changeRate = (argc > 2) ? std::strtod(argv[2], 0) : 1000.0;
+    if (seconds <= 0 || changeRate <= 0)
+    {
+        fprintf(stderr, "usage: %s [seconds per phase] [changes per second]\n", argv[0]);
+        return 1;
+    }
+
+    sdrplay_api_stub_SetDevices("RSP1A");
+    SoapySDR_setLogLevel(SOAPY_SDR_WARNING);
+
+    SoapySDR::Kwargs args;
+    args["serial"] = "STUB0000";
+    SoapySDRPlay3 dev(args);
+    dev.setSampleRate(SOAPY_SDR_RX, 0, 8e6);
+    SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, "CS16", std::vector<size_t>{ 0 });
+    dev.activateStream(stream);
+
+    PhaseResult idle, stress;
+    runPhase(dev, stream, seconds, 0.0, idle);
+    runPhase(dev, stream, seconds, changeRate, stress);
+
+    dev.deactivateStream(stream);
+    dev.closeStream(stream);
+
+    printf("{\n");
+    printPhase("streaming", idle, false);
+    printPhase("with_changes", stress, true);
+    printf("}\n");
+
+    // the stream must keep flowing while the settings change
+    bool ok = idle.samplesRead > 0 && stress.samplesRead > 0 && idle.errors == 0 && stress.errors == 0;
+    return ok ? 0 : 1;
+}